@@ -0,0 +1,303 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+
+#include "global.h"
+
+#include <stddef.h>
+#include <util/delay.h>
+
+#include "rda5807m.h"
+#include "sched.h"
+#include "scan.h"
+#include "af.h"
+
+typedef enum
+{
+	AF_MONITOR,
+	AF_CONFIRM
+} AF_STATE;
+
+AF_TABLE afTable;
+AF_STATS afStats;
+
+static AF_STATE _afState = AF_MONITOR;
+static unsigned char _afLowCount;
+static unsigned char _afBackoff;
+static unsigned short _afTimer;
+static unsigned short _afHomeChannel;
+static unsigned short _afPI;
+static unsigned short _afOtherPI;
+static unsigned char _afPIMatches;
+static BOOL _afPIRejected;
+static AF_ENTRY *_afCandidate;
+
+static AF_ENTRY *selectCandidate()
+{
+	AF_ENTRY *entry;
+	AF_ENTRY *best = NULL;
+	unsigned char pos;
+	
+	// Never probed frequencies first, otherwise the one with the best RSSI history.
+	for(pos = 0; pos < afTable.count; pos++)
+	{
+		entry = &afTable.entries[pos];
+		if(entry->rejected == TRUE)
+		{
+			continue;
+		}
+		
+		if(entry->probes == 0)
+		{
+			return entry;
+		}
+		
+		if((best == NULL) || (entry->rssi > best->rssi))
+		{
+			best = entry;
+		}
+	}
+	
+	return best;
+}
+
+static unsigned char probeChannel(unsigned char channel)
+{
+	unsigned short rxData[2];
+	unsigned short startTick, elapsed;
+	unsigned char timeout = getStcTimeout();
+	
+	// Mute and tune are sent in one transaction.
+	setReceiverMute(TRUE);
+	updateChannel(channel);
+	startTick = getSystemTicks();
+	
+	// STC wait is sized from the measured STC time, same as the band scan steps.
+	do
+	{
+		rxData[0] = 0;
+		readConfiguration(rxData);
+		elapsed = getSystemTicks() - startTick;
+		
+		if((rxData[0] & RDA5807_SEEK_TUNE_COMPLETE) && ((rxData[0] & RDA5807_CHANNEL_INFO) == channel))
+		{
+			addStcTime((unsigned char)elapsed);
+			return rxData[1] >> RDA5807_RSSI_SHIFT;
+		}
+		
+		_delay_us(AF_PROBE_STEP_US);
+	}
+	while(elapsed < timeout);
+	
+	return 0;
+}
+
+static void increaseBackoff()
+{
+	if(_afBackoff < AF_PROBE_BACKOFF_MAX)
+	{
+		_afBackoff++;
+	}
+}
+
+static void returnHome()
+{
+	setReceiverMute(FALSE);
+	updateChannel(_afHomeChannel);
+}
+
+BOOL screenAFGroup(RDS_GROUP *group)
+{
+	if(_afState != AF_CONFIRM)
+	{
+		return FALSE;
+	}
+	
+	// Groups of the candidate are held back from the decoder, only block A is checked until the PI matches.
+	if(((group->errors >> 2) & 0x03) == RDS_BLER_FAIL)
+	{
+		return TRUE;
+	}
+	
+	if(group->blocks[0] == _afPI)
+	{
+		if(_afPIMatches < AF_PI_MATCHES)
+		{
+			_afPIMatches++;
+		}
+	}
+	else
+	{
+		// Another program is rejected once its PI is received twice in a row.
+		if((_afPIMatches == 0) && (group->blocks[0] == _afOtherPI))
+		{
+			_afPIRejected = TRUE;
+		}
+		
+		_afOtherPI = group->blocks[0];
+		_afPIMatches = 0;
+	}
+	
+	return (_afPIMatches < AF_PI_MATCHES) ? TRUE : FALSE;
+}
+
+void resetAFTable()
+{
+	afTable.count = 0;
+	_afState = AF_MONITOR;
+	_afLowCount = 0;
+	_afBackoff = 0;
+	_afTimer = 0;
+}
+
+void updateAFTable(RDS_DATA *rds, unsigned short channel)
+{
+	unsigned char afPos, pos;
+	
+	for(afPos = 0; afPos < rds->afCount; afPos++)
+	{
+		if(rds->af[afPos] == channel)
+		{
+			continue;
+		}
+		
+		for(pos = 0; pos < afTable.count; pos++)
+		{
+			if(afTable.entries[pos].channel == rds->af[afPos])
+			{
+				break;
+			}
+		}
+		
+		if((pos == afTable.count) && (afTable.count < AF_TABLE_SIZE))
+		{
+			afTable.entries[pos].channel = rds->af[afPos];
+			afTable.entries[pos].rssi = 0;
+			afTable.entries[pos].probes = 0;
+			afTable.entries[pos].rejected = FALSE;
+			afTable.count++;
+		}
+	}
+}
+
+BOOL serviceAF(unsigned short *rxData, RDS_DATA *rds)
+{
+	unsigned char rssi = rxData[1] >> RDA5807_RSSI_SHIFT;
+	unsigned char probeRSSI;
+	
+	if(_afTimer < 0xFFFF)
+	{
+		_afTimer++;
+	}
+	
+	if(_afState == AF_CONFIRM)
+	{
+		// Switch is committed only if the new frequency carries the same program.
+		if(_afPIMatches >= AF_PI_MATCHES)
+		{
+			afStats.switches++;
+			
+			// Previous frequency becomes an alternative of the new one.
+			_afCandidate->channel = _afHomeChannel;
+			_afCandidate->probes = 0;
+			_afCandidate->rssi = 0;
+			_afState = AF_MONITOR;
+			_afBackoff = 0;
+			return TRUE;
+		}
+		
+		if((_afPIRejected == FALSE) && (_afTimer < AF_CONFIRM_POLLS))
+		{
+			return FALSE;
+		}
+		
+		// Wrong or missing PI, go back to the original frequency.
+		afStats.rejects++;
+		_afCandidate->rejected = TRUE;
+		_afState = AF_MONITOR;
+		_afTimer = 0;
+		increaseBackoff();
+		flushRDSGroups();
+		returnHome();
+		return FALSE;
+	}
+	
+	// Only a known program with an AF list can be followed.
+	if((!(rds->valid & RDS_FIELD_PI)) || (rssi >= AF_SWITCH_RSSI))
+	{
+		_afLowCount = 0;
+		_afBackoff = 0;
+		return FALSE;
+	}
+	
+	if(_afLowCount < AF_LOW_POLLS)
+	{
+		_afLowCount++;
+		return FALSE;
+	}
+	
+	// Each probe is a short muted gap, keep them rare while no better frequency is found.
+	if(_afTimer < (AF_PROBE_INTERVAL << _afBackoff))
+	{
+		return FALSE;
+	}
+	
+	_afCandidate = selectCandidate();
+	if(_afCandidate == NULL)
+	{
+		return FALSE;
+	}
+	
+	// Short muted probe: tune and one RSSI read.
+	afStats.probes++;
+	_afTimer = 0;
+	_afHomeChannel = rxData[0] & RDA5807_CHANNEL_INFO;
+	probeRSSI = probeChannel(_afCandidate->channel);
+	
+	_afCandidate->rssi = (_afCandidate->probes == 0) ? probeRSSI : ((_afCandidate->rssi + probeRSSI) >> 1);
+	if(_afCandidate->probes < 0xFF)
+	{
+		_afCandidate->probes++;
+	}
+	
+	if(probeRSSI < (rssi + AF_SWITCH_MARGIN))
+	{
+		increaseBackoff();
+		returnHome();
+		return FALSE;
+	}
+	
+	// Stay on the candidate and wait for its PI code.
+	setReceiverMute(FALSE);
+	commitReceiverConfig();
+	
+	_afPI = rds->pi;
+	_afOtherPI = _afPI;
+	_afPIMatches = 0;
+	_afPIRejected = FALSE;
+	_afState = AF_CONFIRM;
+	_afLowCount = 0;
+	flushRDSGroups();
+	
+	// Channel change is reported only after the PI code is confirmed.
+	return FALSE;
+}
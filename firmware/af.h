@@ -0,0 +1,80 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef AF_H_
+#define AF_H_
+
+#include "global.h"
+#include "rds.h"
+
+#define AF_TABLE_SIZE		RDS_AF_MAX
+
+// Current RSSI below AF_SWITCH_RSSI for AF_LOW_POLLS status polls starts the AF probing.
+#define AF_SWITCH_RSSI		25
+#define AF_LOW_POLLS		10
+
+// Candidate must be stronger than the current channel by this margin.
+#define AF_SWITCH_MARGIN	6
+
+// Minimum number of status polls between two probes, doubled after each failed probe up to AF_PROBE_BACKOFF_MAX times.
+#define AF_PROBE_INTERVAL		50
+#define AF_PROBE_BACKOFF_MAX	4
+
+// STC wait of the probe is getStcTimeout() (10 - 60ms) of status reads, AF_PROBE_STEP_US apart.
+#define AF_PROBE_STEP_US	250
+
+// Number of status polls to receive the PI code after the switch.
+#define AF_CONFIRM_POLLS	75
+
+// Identical PI codes in a row which confirm (or, if different, reject) the candidate, same rule as the decoder.
+#define AF_PI_MATCHES		2
+
+typedef struct
+{
+	unsigned char channel;
+	unsigned char rssi;			// Averaged probe RSSI, 0 if never probed.
+	unsigned char probes;
+	BOOL rejected;				// PI mismatch, never switched to again.
+} AF_ENTRY;
+
+typedef struct
+{
+	AF_ENTRY entries[AF_TABLE_SIZE];
+	unsigned char count;
+} AF_TABLE;
+
+typedef struct
+{
+	unsigned short probes;
+	unsigned short switches;
+	unsigned short rejects;
+} AF_STATS;
+
+extern AF_TABLE afTable;
+extern AF_STATS afStats;
+
+void resetAFTable();
+void updateAFTable(RDS_DATA *rds, unsigned short channel);
+BOOL serviceAF(unsigned short *rxData, RDS_DATA *rds);
+BOOL screenAFGroup(RDS_GROUP *group);
+
+#endif /* AF_H_ */
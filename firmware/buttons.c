@@ -0,0 +1,109 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#include "global.h"
+
+#include <avr/io.h>
+
+#include "events.h"
+#include "buttons.h"
+
+// Debounced state (1 = pressed) and the two bit planes of the per button sample counters.
+static unsigned short _buttonState;
+static unsigned short _buttonCount0;
+static unsigned short _buttonCount1;
+
+static unsigned short _buttonHold;
+static unsigned short _buttonLong;
+static unsigned char _buttonDivider;
+
+static unsigned short readButtonLines()
+{
+	return (~((BUTTON_ROTARY_PIN & BUTTON_ROTARY_LINE) ? (BUTTON_PANEL_PIN | BUTTON_ROTARY) : BUTTON_PANEL_PIN)) & (BUTTON_PANEL_MASK | BUTTON_ROTARY);
+}
+
+void initButtons()
+{
+	// Buttons held down at power up are taken as the initial state, they report no press.
+	_buttonState = readButtonLines();
+	_buttonCount0 = 0xFFFF;
+	_buttonCount1 = 0xFFFF;
+	_buttonHold = 0;
+	_buttonLong = 0;
+	_buttonDivider = 0;
+}
+
+static void postButtonEvents(unsigned char type, unsigned short buttons)
+{
+	unsigned char index = 0;
+	
+	while(buttons != 0)
+	{
+		if(buttons & 0x01)
+		{
+			postEvent(type | index);
+		}
+		
+		buttons >>= 1;
+		index++;
+	}
+}
+
+void buttonTick()
+{
+	unsigned short changed;
+	
+	if((++_buttonDivider) < BUTTON_SAMPLE_TICKS)
+	{
+		return;
+	}
+	
+	_buttonDivider = 0;
+	
+	// Vertical counters, every button which differs from the debounced state counts down, others are reset.
+	changed = _buttonState ^ readButtonLines();
+	_buttonCount0 = ~(_buttonCount0 & changed);
+	_buttonCount1 = _buttonCount0 ^ (_buttonCount1 & changed);
+	
+	// Counter roll over after 4 samples toggles the debounced state.
+	changed &= _buttonCount0 & _buttonCount1;
+	_buttonState ^= changed;
+	
+	// Debounced edges are posted to the main context, releases after a long press are not reported.
+	if(changed != 0)
+	{
+		postButtonEvents(EV_BUTTON_PRESS, (_buttonState & changed));
+		postButtonEvents(EV_BUTTON_RELEASE, ((~_buttonState) & changed & (~_buttonLong)));
+		_buttonLong &= _buttonState;
+	}
+	
+	// Long press is measured while the set of pressed buttons is stable.
+	if((changed != 0) || (_buttonState == 0))
+	{
+		_buttonHold = 0;
+	}
+	else if((_buttonHold < BUTTON_LONG_SAMPLES) && ((++_buttonHold) == BUTTON_LONG_SAMPLES))
+	{
+		_buttonLong |= _buttonState;
+		postButtonEvents(EV_BUTTON_LONG, _buttonState);
+	}
+}
@@ -0,0 +1,46 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef BUTTONS_H_
+#define BUTTONS_H_
+
+#include "global.h"
+
+// Panel buttons on PINB (bits 7:0) and the encoder push button on PC3 (bit 8), all active low.
+#define BUTTON_PANEL_PIN	PINB
+#define BUTTON_ROTARY_PIN	PINC
+#define BUTTON_ROTARY_LINE	0x08
+
+#define BUTTON_PANEL_MASK	0x00FF
+#define BUTTON_ROTARY		0x0100
+
+// Number of buttonTick calls (1ms) per debouncer sample, a change is accepted after 4 equal samples.
+// Press, release (before the long press time) and long press edges are posted as events with the button index.
+#define BUTTON_SAMPLE_TICKS	5
+
+// Hold time (in samples) of a long press, 300 x 5ms = 1.5s.
+#define BUTTON_LONG_SAMPLES	300
+
+void initButtons();
+void buttonTick();
+
+#endif /* BUTTONS_H_ */
@@ -0,0 +1,176 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#include "global.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "encoder.h"
+
+#define ENCODER_INVALID		2
+#define ENCODER_MAX_STEPS	1000
+
+// Quarter step direction indexed by (previous state << 2) | current state, state is (A << 1) | B.
+// Clockwise sequence is 3 -> 1 -> 0 -> 2 -> 3, ENCODER_INVALID marks transitions with both lines changed.
+static const signed char _encoderTable[16] PROGMEM = 
+{
+	0, -1, 1, ENCODER_INVALID,
+	1, 0, ENCODER_INVALID, -1,
+	-1, ENCODER_INVALID, 0, 1,
+	ENCODER_INVALID, 1, -1, 0
+};
+
+ENCODER_STATS encoderStats;
+
+static unsigned char _encoderState;
+static signed char _encoderQuarter;
+static unsigned char _encoderInterval;
+static signed char _encoderLastDir;
+
+static volatile signed short _encoderSteps;
+
+static unsigned char readEncoderState()
+{
+	unsigned char pins = ENCODER_PIN;
+	return ((pins & ENCODER_LINE_A) ? 0x02 : 0x00) | ((pins & ENCODER_LINE_B) ? 0x01 : 0x00);
+}
+
+void initEncoder()
+{
+	_encoderState = readEncoderState();
+	_encoderQuarter = 0;
+	_encoderInterval = 0xFF;
+	_encoderLastDir = 0;
+	_encoderSteps = 0;
+}
+
+static unsigned char getDetentWeight(signed char dir)
+{
+	unsigned char interval = _encoderInterval;
+	
+	_encoderInterval = 0;
+	
+	// Direction change always restarts with single steps.
+	if(dir != _encoderLastDir)
+	{
+		_encoderLastDir = dir;
+		return 1;
+	}
+	
+	if(interval < ENCODER_FAST_TICKS)
+	{
+		return ENCODER_FAST_STEPS;
+	}
+	else if(interval < ENCODER_MEDIUM_TICKS)
+	{
+		return ENCODER_MEDIUM_STEPS;
+	}
+	else if(interval < ENCODER_SLOW_TICKS)
+	{
+		return ENCODER_SLOW_STEPS;
+	}
+	
+	return 1;
+}
+
+void encoderTick()
+{
+	unsigned char state = readEncoderState();
+	signed char dir, steps;
+	
+	if(_encoderInterval < 0xFF)
+	{
+		_encoderInterval++;
+	}
+	
+	if(state == _encoderState)
+	{
+		return;
+	}
+	
+	dir = pgm_read_byte(&_encoderTable[(_encoderState << 2) | state]);
+	_encoderState = state;
+	
+	if(dir == ENCODER_INVALID)
+	{
+		encoderStats.invalid++;
+		return;
+	}
+	
+	_encoderQuarter += dir;
+	
+	// Detent is reported on return to the rest state, one missed quarter step is tolerated.
+	if(state != 0x03)
+	{
+		return;
+	}
+	
+	dir = (_encoderQuarter >= 2) ? 1 : ((_encoderQuarter <= -2) ? -1 : 0);
+	_encoderQuarter = 0;
+	
+	if(dir == 0)
+	{
+		return;
+	}
+	
+	encoderStats.detents++;
+	steps = getDetentWeight(dir);
+	
+	// Accumulate until the consumer reads, saturate instead of wrapping.
+	if(((dir > 0) && (_encoderSteps > (ENCODER_MAX_STEPS - steps))) || ((dir < 0) && (_encoderSteps < (steps - ENCODER_MAX_STEPS))))
+	{
+		encoderStats.overflows++;
+		return;
+	}
+	
+	_encoderSteps += (dir > 0) ? steps : -steps;
+}
+
+signed short readEncoder()
+{
+	signed short steps;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		steps = _encoderSteps;
+		_encoderSteps = 0;
+	}
+	
+	return steps;
+}
+
+void clearEncoder()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		_encoderSteps = 0;
+		_encoderQuarter = 0;
+		_encoderLastDir = 0;
+	}
+}
+
+BOOL isEncoderIdle()
+{
+	return (_encoderState == 0x03) ? TRUE : FALSE;
+}
@@ -0,0 +1,58 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+#include "global.h"
+
+// Rotary encoder channels, both lines are high at the detent position.
+#define ENCODER_PIN			PINC
+#define ENCODER_LINE_A		0x10
+#define ENCODER_LINE_B		0x20
+
+// Detent intervals (in encoderTick calls, 1ms) of the acceleration levels.
+#define ENCODER_FAST_TICKS		20
+#define ENCODER_MEDIUM_TICKS	40
+#define ENCODER_SLOW_TICKS		80
+
+// Steps reported for one detent at each acceleration level.
+#define ENCODER_FAST_STEPS		8
+#define ENCODER_MEDIUM_STEPS	4
+#define ENCODER_SLOW_STEPS		2
+
+typedef struct
+{
+	unsigned short detents;
+	unsigned short invalid;			// Transitions which skipped a state (both lines changed).
+	unsigned short overflows;
+} ENCODER_STATS;
+
+extern ENCODER_STATS encoderStats;
+
+void initEncoder();
+void encoderTick();
+signed short readEncoder();
+void clearEncoder();
+BOOL isEncoderIdle();
+
+#endif /* ENCODER_H_ */
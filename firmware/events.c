@@ -0,0 +1,72 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#include "global.h"
+
+#include "events.h"
+
+volatile EVENT_STATS eventStats;
+
+// Single producer (interrupt) / single consumer (main) ring, each index is written by one side only.
+static volatile unsigned char _eventQueue[EVENT_QUEUE_SIZE];
+static volatile unsigned char _eventHead;
+static volatile unsigned char _eventTail;
+
+BOOL postEvent(unsigned char event)
+{
+	unsigned char head = _eventHead;
+	unsigned char depth = head - _eventTail;
+	
+	if(depth >= EVENT_QUEUE_SIZE)
+	{
+		eventStats.overflows++;
+		return FALSE;
+	}
+	
+	_eventQueue[head & (EVENT_QUEUE_SIZE - 1)] = event;
+	
+	// Publish the event after the slot is written.
+	_eventHead = head + 1;
+	
+	eventStats.posted++;
+	if(depth >= eventStats.maxDepth)
+	{
+		eventStats.maxDepth = depth + 1;
+	}
+	
+	return TRUE;
+}
+
+BOOL readEvent(unsigned char *event)
+{
+	unsigned char tail = _eventTail;
+	
+	if(tail == _eventHead)
+	{
+		return FALSE;
+	}
+	
+	*event = _eventQueue[tail & (EVENT_QUEUE_SIZE - 1)];
+	_eventTail = tail + 1;
+	
+	return TRUE;
+}
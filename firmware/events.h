@@ -0,0 +1,51 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+#include "global.h"
+
+// Number of pending events held between the interrupts and the main context (power of 2).
+#define EVENT_QUEUE_SIZE	16
+
+// Event code is the type (high nibble) and an argument (low nibble), such as the button index.
+#define EVENT_TYPE(event)	((event) & 0xF0)
+#define EVENT_ARG(event)	((event) & 0x0F)
+
+#define EV_BUTTON_PRESS		0x10
+#define EV_BUTTON_RELEASE	0x20
+#define EV_BUTTON_LONG		0x30
+
+typedef struct
+{
+	unsigned short posted;
+	unsigned short overflows;
+	unsigned char maxDepth;
+} EVENT_STATS;
+
+extern volatile EVENT_STATS eventStats;
+
+BOOL postEvent(unsigned char event);
+BOOL readEvent(unsigned char *event);
+
+#endif /* EVENTS_H_ */
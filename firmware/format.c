@@ -0,0 +1,75 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+
+#include "global.h"
+
+#include <string.h>
+#include <avr/pgmspace.h>
+
+#include "format.h"
+
+static const unsigned short _decimalPlaces[] PROGMEM = {10000, 1000, 100, 10};
+
+unsigned char formatNumber(unsigned short value, char *str)
+{
+	unsigned char placePos, len = 0;
+	unsigned short place;
+	char digit;
+	
+	// Digits are extracted by subtraction, AVR has no hardware divider.
+	for(placePos = 0; placePos < (sizeof(_decimalPlaces) / sizeof(_decimalPlaces[0])); placePos++)
+	{
+		place = pgm_read_word(&_decimalPlaces[placePos]);
+		digit = '0';
+		
+		while(value >= place)
+		{
+			value -= place;
+			digit++;
+		}
+		
+		// Skip leading zeros.
+		if((digit != '0') || (len > 0))
+		{
+			str[len++] = digit;
+		}
+	}
+	
+	str[len++] = '0' + value;
+	str[len] = 0;
+	
+	return len;
+}
+
+unsigned char formatFrequency(unsigned short channel, char *str)
+{
+	unsigned char len = formatNumber((FORMAT_BASE_FREQ + channel), str);
+	
+	// Insert decimal point before the 100kHz digit, channel spacing is 100kHz so the last digit is always 0.
+	str[len] = str[len - 1];
+	str[len - 1] = '.';
+	str[len + 1] = '0';
+	strcpy_P(&str[len + 2], PSTR(" MHz  "));
+	
+	return len + 8;
+}
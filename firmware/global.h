@@ -39,8 +39,6 @@
 #define IDLE_LIMIT_VOLUME	70
 #define IDLE_LIMIT_TUNER	150
 
-#define LONG_PRESS_COUNTS	15
-
 typedef enum
 {
 	FALSE = 0x00,
@@ -54,6 +52,14 @@ typedef enum
 	MA_SAVE
 } MEM_ACTION;
 
+typedef enum
+{
+	SA_NONE,
+	SA_UP,
+	SA_DOWN,
+	SA_ABORT
+} SEEK_ACTION;
+
 typedef struct
 {
 	unsigned char volume;
@@ -20,113 +20,432 @@
  * SOFTWARE.
  *********************************************************************************/
 
+
 #include "iic.h"
 
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay.h>
 #include <util/twi.h>
 
-#define TWI_READ	0x01
-#define TWI_WRITE	0x00
+#define TWI_LANE_COUNT	2
+
+// TWI pins of the ATmega16: SCL is PC0 and SDA is PC1.
+#define TWI_SCL_PIN		0x01
+#define TWI_SDA_PIN		0x02
+
+#define TWCR_START		((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_NEXT		((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_NEXT_ACK	((1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_STOP		((1 << TWINT) | (1 << TWSTO) | (1 << TWEN))
+
+volatile TWI_STATS twiStats;
+
+static TWI_TRANSACTION *_twiQueue[TWI_LANE_COUNT][TWI_QUEUE_SIZE];
+static volatile unsigned char _twiQueueHead[TWI_LANE_COUNT];
+static volatile unsigned char _twiQueueCount[TWI_LANE_COUNT];
+
+static TWI_TRANSACTION * volatile _twiActive = NULL;
+static volatile unsigned char _twiDataPos;
+static volatile BOOL _twiRegPending;
 
-BOOL twiStart(unsigned char addr)
+// Incremented on every bus event, used by the timeout logic to detect stalled transfers.
+static volatile unsigned char _twiEventCount;
+static unsigned char _twiTickEvent;
+static unsigned char _twiStallTicks;
+
+// Failed transfer waiting for the bus recovery, TWI_OK if none. Recovery runs from the main context only.
+static volatile TWI_RESULT _twiRecoverResult = TWI_OK;
+
+static TWI_TRANSACTION *twiDequeue()
 {
-	unsigned char ackStatus;
+	TWI_TRANSACTION *trans;
+	unsigned char lane = TWI_LANE_PRIORITY;
 	
-	// Reset TWI and wait for end of transmission of START signal.
-	TWCR = 0;
-	TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
-	while(!(TWCR & (1 << TWINT)));
+	// Priority lane is always drained before the normal lane.
+	if(_twiQueueCount[lane] == 0)
+	{
+		lane = TWI_LANE_NORMAL;
+		if(_twiQueueCount[lane] == 0)
+		{
+			return NULL;
+		}
+	}
 	
-	if((TWSR & 0xF8) != TW_START)
+	trans = _twiQueue[lane][_twiQueueHead[lane]];
+	_twiQueueHead[lane] = (_twiQueueHead[lane] + 1) % TWI_QUEUE_SIZE;
+	_twiQueueCount[lane]--;
+	
+	return trans;
+}
+
+static void twiBegin(TWI_TRANSACTION *trans)
+{
+	_twiDataPos = 0;
+	_twiRegPending = (trans->flags & TWI_FLAG_REG_INDEX) ? TRUE : FALSE;
+	trans->status = TWI_BUSY;
+}
+
+static void twiFinish(TWI_RESULT result)
+{
+	TWI_TRANSACTION *trans = _twiActive;
+	TWI_CALLBACK callback = trans->callback;
+	
+	_twiStallTicks = 0;
+	
+	if(result != TWI_OK)
 	{
-		// Fail to send START signal.
-		return FALSE;
+		twiStats.errors++;
+		
+		// Restart the same transaction until the retry limit is reached.
+		if(trans->retries < TWI_MAX_RETRIES)
+		{
+			trans->retries++;
+			twiStats.retries++;
+			twiBegin(trans);
+			TWCR = TWCR_STOP | TWCR_START;
+			return;
+		}
 	}
 	
-	// Transmit slave device address.
-	TWDR = addr;
-	TWCR = (1 << TWINT) | (1 << TWEN);
-	while(!(TWCR & (1 << TWINT)));
+	twiStats.transfers++;
+	trans->result = result;
+	trans->status = (result == TWI_OK) ? TWI_DONE : TWI_FAILED;
 	
-	// Waiting ACK from slave device.
-	ackStatus = TW_STATUS & 0xF8;
-	if ((ackStatus != TW_MT_SLA_ACK) && (ackStatus != TW_MR_SLA_ACK))
+	// Callback may queue follow-up transactions, but it never starts the bus while active.
+	if(callback != NULL)
 	{
-		return FALSE;
+		callback(trans);
 	}
 	
-	return TRUE;
+	_twiActive = twiDequeue();
+	if(_twiActive != NULL)
+	{
+		// Release the bus and issue START for the next transaction in one step.
+		twiBegin(_twiActive);
+		TWCR = TWCR_STOP | TWCR_START;
+	}
+	else
+	{
+		TWCR = TWCR_STOP;
+	}
+}
+
+static void twiRequestByte()
+{
+	// Acknowledge all received bytes except the last one.
+	TWCR = ((_twiDataPos + 1) < _twiActive->length) ? TWCR_NEXT_ACK : TWCR_NEXT;
+}
+
+static void twiProcess()
+{
+	TWI_TRANSACTION *trans = _twiActive;
+	
+	_twiEventCount++;
+	
+	if(trans == NULL)
+	{
+		// Spurious event without active transaction.
+		TWCR = TWCR_STOP;
+		return;
+	}
+	
+	switch(TW_STATUS)
+	{
+		case TW_START:
+		case TW_REP_START:
+			// Transmit slave device address with direction bit, register index is always written.
+			TWDR = trans->addr | ((_twiRegPending == TRUE) ? TWI_WRITE : trans->direction);
+			TWCR = TWCR_NEXT;
+			break;
+			
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			if(_twiRegPending == TRUE)
+			{
+				// Submit register index of the random access transfer.
+				TWDR = trans->regIndex;
+				TWCR = TWCR_NEXT;
+				_twiRegPending = FALSE;
+			}
+			else if(trans->direction == TWI_READ)
+			{
+				// Register index is sent, switch to read with repeated START.
+				TWCR = TWCR_START;
+			}
+			else if(_twiDataPos < trans->length)
+			{
+				// Submit next byte to the slave device.
+				TWDR = trans->buffer[_twiDataPos++];
+				TWCR = TWCR_NEXT;
+			}
+			else
+			{
+				twiFinish(TWI_OK);
+			}
+			break;
+			
+		case TW_MR_SLA_ACK:
+			twiRequestByte();
+			break;
+			
+		case TW_MR_DATA_ACK:
+			trans->buffer[_twiDataPos++] = TWDR;
+			twiRequestByte();
+			break;
+			
+		case TW_MR_DATA_NACK:
+			// Last data byte of the read transaction.
+			trans->buffer[_twiDataPos++] = TWDR;
+			twiFinish(TWI_OK);
+			break;
+			
+		case TW_MT_SLA_NACK:
+		case TW_MR_SLA_NACK:
+			twiFinish(TWI_ERR_ADDR_NACK);
+			break;
+			
+		case TW_MT_DATA_NACK:
+			twiFinish(TWI_ERR_DATA_NACK);
+			break;
+			
+		case TW_MT_ARB_LOST:
+			twiFinish(TWI_ERR_ARB_LOST);
+			break;
+			
+		default:
+			// Bus error: stop the module, bus is recovered by twiServiceRecovery.
+			TWCR = 0;
+			_twiRecoverResult = TWI_ERR_BUS;
+			break;
+	}
 }
 
-BOOL twiWrite(unsigned char data)
+static void twiAbort()
 {
-	TWDR = data;
-	TWCR = (1<<TWINT) | (1<<TWEN);
-	while(!(TWCR & (1 << TWINT)));
-	return ((TWSR & 0xF8) != TW_MT_DATA_ACK) ? FALSE : TRUE;
+	// Active transfer is stalled: stop the module, bus is recovered by twiServiceRecovery.
+	twiStats.timeouts++;
+	TWCR = 0;
+	_twiRecoverResult = TWI_ERR_TIMEOUT;
+}
+
+static void twiServiceRecovery()
+{
+	TWI_RESULT result;
+	
+	if(_twiRecoverResult == TWI_OK)
+	{
+		return;
+	}
+	
+	// Bit-banged clocking (~100us) runs with interrupts enabled, and never races the PORTC users of the main loop.
+	twiRecoverBus();
+	
+	// Retry or fail the transaction, next transfer starts from here.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		result = _twiRecoverResult;
+		_twiRecoverResult = TWI_OK;
+		twiFinish(result);
+	}
 }
 
-void twiStop()
+static void twiPoll()
 {
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWSTO);
+	// With global interrupts disabled (boot or ISR context) the engine is driven by polling.
+	if((!(SREG & (1 << SREG_I))) && (TWCR & (1 << TWINT)))
+	{
+		twiProcess();
+	}
 }
 
-unsigned char twiReadAck()
+ISR (TWI_vect)
 {
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA); 
-	while(!(TWCR & (1 << TWINT)));
-	return TWDR;
+	twiProcess();
 }
 
-unsigned char twiReadNAck()
+void twiRecoverBus()
 {
-	TWCR = (1 << TWINT) | (1 << TWEN);
-	while(!(TWCR & (1<<TWINT)));
-	return TWDR;
+	unsigned char clockPos;
+	
+	twiStats.recoveries++;
+	
+	// Release TWI module and take control of the bus lines (open-drain emulation).
+	TWCR = 0;
+	DDRC &= ~(TWI_SCL_PIN | TWI_SDA_PIN);
+	PORTC &= ~(TWI_SCL_PIN | TWI_SDA_PIN);
+	
+	// Clock out up to 9 bits to release slave device which is holding SDA low.
+	for(clockPos = 0; clockPos < 9; clockPos++)
+	{
+		if(PINC & TWI_SDA_PIN)
+		{
+			break;
+		}
+		
+		DDRC |= TWI_SCL_PIN;
+		_delay_us(5);
+		DDRC &= ~TWI_SCL_PIN;
+		_delay_us(5);
+	}
+	
+	// Generate STOP condition: SDA goes high while SCL is high.
+	DDRC |= TWI_SDA_PIN;
+	_delay_us(5);
+	DDRC &= ~TWI_SDA_PIN;
+	_delay_us(5);
+	
+	// Restore pull-ups and re-enable TWI module.
+	PORTC |= (TWI_SCL_PIN | TWI_SDA_PIN);
+	TWCR = (1 << TWEN);
 }
 
-BOOL twiWriteReg(unsigned char addr, unsigned char *data, unsigned char dataLen)
+BOOL twiQueue(TWI_TRANSACTION *trans, TWI_LANE lane)
 {
-	unsigned char pos;
+	BOOL retState = FALSE;
 	
-	// Transmit START with slave address.
-	if(twiStart(addr | TWI_WRITE) != TRUE)
+	if((trans == NULL) || ((trans->direction == TWI_READ) && (trans->length == 0)))
 	{
 		return FALSE;
 	}
 	
-	// Submit each byte to the slave device.
-	for(pos = 0; pos < dataLen; pos++)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		twiWrite(data[pos]);
+		if(_twiQueueCount[lane] < TWI_QUEUE_SIZE)
+		{
+			trans->status = TWI_PENDING;
+			trans->result = TWI_OK;
+			trans->retries = 0;
+			_twiQueue[lane][(_twiQueueHead[lane] + _twiQueueCount[lane]) % TWI_QUEUE_SIZE] = trans;
+			_twiQueueCount[lane]++;
+			retState = TRUE;
+			
+			// Start the bus if the engine is idle.
+			if(_twiActive == NULL)
+			{
+				_twiActive = twiDequeue();
+				_twiStallTicks = 0;
+				twiBegin(_twiActive);
+				TWCR = TWCR_START;
+			}
+		}
 	}
 	
-	// Finish transmission with STOP.
-	twiStop();
+	return retState;
+}
+
+BOOL twiIsBusy()
+{
+	return (_twiActive != NULL) ? TRUE : FALSE;
+}
+
+void twiTick()
+{
+	// Background watchdog for transfers which nobody is waiting on.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if((_twiActive == NULL) || (_twiEventCount != _twiTickEvent))
+		{
+			_twiTickEvent = _twiEventCount;
+			_twiStallTicks = 0;
+		}
+		else if((_twiRecoverResult == TWI_OK) && ((++_twiStallTicks) >= TWI_TIMEOUT_TICKS))
+		{
+			twiAbort();
+		}
+	}
 	
-	return TRUE;
+	twiServiceRecovery();
 }
 
-BOOL twiReadReg(unsigned char addr, unsigned char *data, unsigned char dataLen)
+TWI_RESULT twiWait(TWI_TRANSACTION *trans)
 {
-	unsigned char pos;
+	unsigned short idleTime = 0;
+	unsigned char lastEvent = _twiEventCount;
 	
-	// Transmit START with slave address.
-	if(twiStart(addr | TWI_READ) != TRUE)
+	while((trans->status == TWI_PENDING) || (trans->status == TWI_BUSY))
 	{
-		return FALSE;
+		twiPoll();
+		twiServiceRecovery();
+		
+		// Budget is restored whenever the bus makes progress.
+		if(lastEvent != _twiEventCount)
+		{
+			lastEvent = _twiEventCount;
+			idleTime = 0;
+			continue;
+		}
+		
+		_delay_us(TWI_WAIT_STEP_US);
+		idleTime += TWI_WAIT_STEP_US;
+		
+		if(idleTime >= TWI_WAIT_TIMEOUT_US)
+		{
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			{
+				if((_twiActive != NULL) && (lastEvent == _twiEventCount) && (_twiRecoverResult == TWI_OK))
+				{
+					twiAbort();
+				}
+			}
+			
+			idleTime = 0;
+		}
 	}
 	
-	// Capture data received from the device with ACK.
-	for (pos = 0; pos < (dataLen - 1); pos++)
+	return trans->result;
+}
+
+static TWI_RESULT twiTransfer(unsigned char addr, unsigned char direction, unsigned char flags, unsigned char reg, unsigned char *data, unsigned char dataLen, TWI_LANE lane)
+{
+	TWI_TRANSACTION trans;
+	TWI_TRANSACTION *active;
+	
+	if((direction == TWI_READ) && (dataLen == 0))
 	{
-		data[pos] = twiReadAck();
+		return TWI_ERR_INVALID;
 	}
 	
-	// Read last data byte.
-	data[(dataLen - 1)] = twiReadNAck();
+	trans.addr = addr;
+	trans.direction = direction;
+	trans.flags = flags;
+	trans.regIndex = reg;
+	trans.buffer = data;
+	trans.length = dataLen;
+	trans.callback = NULL;
 	
-	// Finish transmission with STOP.
-	twiStop();
+	// Lane is full: let the active transfer complete, bounded by its own timeout.
+	while(twiQueue(&trans, lane) != TRUE)
+	{
+		active = _twiActive;
+		if(active != NULL)
+		{
+			twiWait(active);
+		}
+	}
 	
-	return TRUE;
-}
\ No newline at end of file
+	return twiWait(&trans);
+}
+
+TWI_RESULT twiWriteReg(unsigned char addr, unsigned char *data, unsigned char dataLen)
+{
+	// Register writes (tune, seek, etc.) jump ahead of the background status polls.
+	return twiTransfer(addr, TWI_WRITE, 0, 0, data, dataLen, TWI_LANE_PRIORITY);
+}
+
+TWI_RESULT twiReadReg(unsigned char addr, unsigned char *data, unsigned char dataLen)
+{
+	return twiTransfer(addr, TWI_READ, 0, 0, data, dataLen, TWI_LANE_NORMAL);
+}
+
+TWI_RESULT twiWriteRegAt(unsigned char addr, unsigned char reg, unsigned char *data, unsigned char dataLen)
+{
+	return twiTransfer(addr, TWI_WRITE, TWI_FLAG_REG_INDEX, reg, data, dataLen, TWI_LANE_PRIORITY);
+}
+
+TWI_RESULT twiReadRegAt(unsigned char addr, unsigned char reg, unsigned char *data, unsigned char dataLen)
+{
+	return twiTransfer(addr, TWI_READ, TWI_FLAG_REG_INDEX, reg, data, dataLen, TWI_LANE_NORMAL);
+}
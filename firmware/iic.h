@@ -25,14 +25,89 @@
 
 #include "global.h"
 
-BOOL twiStart(unsigned char addr);
-void twiStop();
+// Number of pending transactions which can be held in each queue lane.
+#define TWI_QUEUE_SIZE	4
 
-BOOL twiWrite(unsigned char data);
-unsigned char twiReadAck();
-unsigned char twiReadNAck();
+#define TWI_READ	0x01
+#define TWI_WRITE	0x00
 
-BOOL twiWriteReg(unsigned char addr, unsigned char *data, unsigned char dataLen);
-BOOL twiReadReg(unsigned char addr, unsigned char *data, unsigned char dataLen);
+// Transaction flags.
+#define TWI_FLAG_REG_INDEX	0x01	// Send register index before the data phase (repeated START for reads).
 
-#endif /* IIC_H_ */
\ No newline at end of file
+// Number of retries for a failed transaction before reporting the error.
+#define TWI_MAX_RETRIES		2
+
+// Maximum time without any bus event before blocking wait aborts the transfer.
+#define TWI_WAIT_TIMEOUT_US	2000
+#define TWI_WAIT_STEP_US	10
+
+// Number of twiTick calls without any bus event before background transfer is aborted.
+#define TWI_TIMEOUT_TICKS	2
+
+typedef enum
+{
+	TWI_IDLE,
+	TWI_PENDING,
+	TWI_BUSY,
+	TWI_DONE,
+	TWI_FAILED
+} TWI_STATUS;
+
+typedef enum
+{
+	TWI_OK = 0,
+	TWI_ERR_ADDR_NACK,
+	TWI_ERR_DATA_NACK,
+	TWI_ERR_ARB_LOST,
+	TWI_ERR_BUS,
+	TWI_ERR_TIMEOUT,
+	TWI_ERR_INVALID
+} TWI_RESULT;
+
+typedef enum
+{
+	TWI_LANE_NORMAL = 0,
+	TWI_LANE_PRIORITY
+} TWI_LANE;
+
+struct TWI_TRANSACTION;
+typedef void (*TWI_CALLBACK)(struct TWI_TRANSACTION *trans);
+
+typedef struct TWI_TRANSACTION
+{
+	unsigned char addr;
+	unsigned char direction;
+	unsigned char flags;
+	unsigned char regIndex;
+	unsigned char *buffer;
+	unsigned char length;
+	volatile TWI_STATUS status;
+	volatile TWI_RESULT result;
+	unsigned char retries;
+	TWI_CALLBACK callback;
+} TWI_TRANSACTION;
+
+typedef struct
+{
+	unsigned short transfers;
+	unsigned short errors;
+	unsigned short retries;
+	unsigned short timeouts;
+	unsigned short recoveries;
+} TWI_STATS;
+
+extern volatile TWI_STATS twiStats;
+
+BOOL twiQueue(TWI_TRANSACTION *trans, TWI_LANE lane);
+BOOL twiIsBusy();
+TWI_RESULT twiWait(TWI_TRANSACTION *trans);
+void twiTick();
+void twiRecoverBus();
+
+TWI_RESULT twiWriteReg(unsigned char addr, unsigned char *data, unsigned char dataLen);
+TWI_RESULT twiReadReg(unsigned char addr, unsigned char *data, unsigned char dataLen);
+
+TWI_RESULT twiWriteRegAt(unsigned char addr, unsigned char reg, unsigned char *data, unsigned char dataLen);
+TWI_RESULT twiReadRegAt(unsigned char addr, unsigned char reg, unsigned char *data, unsigned char dataLen);
+
+#endif /* IIC_H_ */
\ No newline at end of file
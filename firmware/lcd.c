@@ -25,101 +25,344 @@
 #include <stddef.h>
 #include <string.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
 #include "lcd.h"
 
-void writeLCDCmd(unsigned char cmd)
+#define LCD_TX_DATA		0x01
+#define LCD_TX_LONG		0x02
+#define LCD_TX_RESET	0x04
+
+// Ticks to wait after clear display and return home (with ~10% margin).
+#define LCD_LONG_TICKS	(((LCD_EXEC_LONG_US + 150) / LCD_TICK_US) + 1)
+
+// Ticks to wait after each nibble of the reset sequence (with ~10% margin).
+#define LCD_RESET_TICKS	(((LCD_EXEC_RESET_US + 400) / LCD_TICK_US) + 1)
+
+// Busy flag polls (one per tick) of an instruction before the flag is given up, twice the longest execution time.
+#define LCD_BUSY_TICKS	(LCD_LONG_TICKS * 2)
+
+typedef struct
+{
+	unsigned char value;
+	unsigned char flags;
+} LCD_TX_ENTRY;
+
+// Transmit queue, filled by the main loop and drained by the timer2 interrupt.
+static LCD_TX_ENTRY _lcdTxQueue[LCD_QUEUE_SIZE];
+static volatile unsigned char _lcdTxHead;
+static volatile unsigned char _lcdTxTail;
+static volatile BOOL _lcdTxLowNibble = FALSE;
+static volatile unsigned char _lcdTxWait;
+
+#ifdef LCD_USE_BUSY_FLAG
+static unsigned char _lcdBusyTicks;
+static BOOL _lcdBusyLost = FALSE;
+#endif
+
+static void pulseLCDEnable()
+{
+	// Enable pulse width is 450ns minimum, data is latched on the falling edge.
+	PORTD |= LCD_E_PIN;
+	_delay_us(1);
+	PORTD &= ~LCD_E_PIN;
+	_delay_us(1);
+}
+
+static void writeLCDNibble(unsigned char nibble, BOOL data)
+{
+	PORTD = (PORTD & 0x03) | (nibble << 4) | ((data == TRUE) ? LCD_RS_PIN : 0x00);
+	pulseLCDEnable();
+}
+
+#ifdef LCD_USE_BUSY_FLAG
+
+static BOOL isLCDBusy()
 {
+	unsigned char status;
+	
+	// Data lines are inputs while the status register is read.
+	DDRD &= 0x0F;
 	PORTD &= 0x03;
-	_delay_us(50);
-	PORTD |= cmd << 4;
+	LCD_RW_PORT |= LCD_RW_PIN;
+	
+	PORTD |= LCD_E_PIN;
+	_delay_us(1);
+	status = PIND;
+	PORTD &= ~LCD_E_PIN;
+	_delay_us(1);
+	
+	// Low nibble of the status register is ignored.
+	pulseLCDEnable();
+	
+	LCD_RW_PORT &= ~LCD_RW_PIN;
+	DDRD |= 0xF0;
+	
+	return (status & LCD_BUSY_FLAG) ? TRUE : FALSE;
+}
+
+#endif
+
+static void lcdTxTick()
+{
+	LCD_TX_ENTRY *entry;
+	
+	// Instruction is still executing.
+	if(_lcdTxWait > 0)
+	{
+		_lcdTxWait--;
+		return;
+	}
+	
+	if(_lcdTxTail == _lcdTxHead)
+	{
+		// Nothing left to send, timer interrupt is enabled again by the next queued entry.
+		TIMSK &= ~(1 << OCIE2);
+		return;
+	}
+	
+	entry = &_lcdTxQueue[_lcdTxTail & (LCD_QUEUE_SIZE - 1)];
+	
+#ifdef LCD_USE_BUSY_FLAG
+	// Busy flag can not be read before the controller is reset into the 4-bit interface. A flag which stays set
+	// (stuck or missing LCD) is given up after LCD_BUSY_TICKS, the fixed delays are used from then on.
+	if((_lcdBusyLost == FALSE) && (_lcdTxLowNibble == FALSE) && !(entry->flags & LCD_TX_RESET) && (isLCDBusy() == TRUE))
+	{
+		if((++_lcdBusyTicks) < LCD_BUSY_TICKS)
+		{
+			return;
+		}
+		
+		_lcdBusyLost = TRUE;
+	}
+	
+	_lcdBusyTicks = 0;
+#endif
+	
+	// One nibble per tick, high nibble first.
+	if(_lcdTxLowNibble == FALSE)
+	{
+		writeLCDNibble(entry->value >> 4, (entry->flags & LCD_TX_DATA) ? TRUE : FALSE);
+		
+		// Reset sequence runs on the 8-bit interface, only the high nibble is sent.
+		if(entry->flags & LCD_TX_RESET)
+		{
+			_lcdTxWait = LCD_RESET_TICKS;
+			_lcdTxTail++;
+			return;
+		}
+		
+		_lcdTxLowNibble = TRUE;
+		return;
+	}
+	
+	writeLCDNibble(entry->value & 0x0F, (entry->flags & LCD_TX_DATA) ? TRUE : FALSE);
+	_lcdTxLowNibble = FALSE;
+	
+	// Short instructions complete within one tick, clear display and return home need more.
+#ifdef LCD_USE_BUSY_FLAG
+	if(_lcdBusyLost == TRUE)
+#endif
+	{
+		_lcdTxWait = (entry->flags & LCD_TX_LONG) ? LCD_LONG_TICKS : 0;
+	}
+	
+	_lcdTxTail++;
+}
+
+static void driveLCDQueue()
+{
+	// With global interrupts disabled (boot) the queue is drained by polling.
+	if(!(SREG & (1 << SREG_I)))
+	{
+		lcdTxTick();
+		_delay_us(LCD_TICK_US);
+	}
+}
+
+static void queueLCD(unsigned char value, unsigned char flags)
+{
+	// Main loop waits only if the queue is full.
+	while(((unsigned char)(_lcdTxHead - _lcdTxTail)) >= LCD_QUEUE_SIZE)
+	{
+		driveLCDQueue();
+	}
 	
-	// Toggle RS and send upper word to LCD.
-	PORTD |= 0x08;
-	_delay_ms(4);
-	PORTD &= 0xF7;
+	_lcdTxQueue[_lcdTxHead & (LCD_QUEUE_SIZE - 1)].value = value;
+	_lcdTxQueue[_lcdTxHead & (LCD_QUEUE_SIZE - 1)].flags = flags;
 	
-	_delay_ms(4);
+	// Entry is published together with the timer interrupt enable.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		_lcdTxHead++;
+		TIMSK |= (1 << OCIE2);
+	}
+}
+
+ISR (TIMER2_COMP_vect)
+{
+	lcdTxTick();
+}
+
+BOOL isLCDIdle()
+{
+	return ((_lcdTxTail == _lcdTxHead) && (_lcdTxLowNibble == FALSE) && (_lcdTxWait == 0)) ? TRUE : FALSE;
+}
+
+void waitLCDIdle()
+{
+	// Fence: returns once every queued instruction is sent and executed, including the wait of clear display.
+	while(isLCDIdle() == FALSE)
+	{
+		driveLCDQueue();
+	}
+}
+
+void writeLCDCmd(unsigned char cmd)
+{
+	// Only clear display and return home take the long execution time.
+	queueLCD(cmd, ((cmd <= LCD_CMD_HOME_MAX) ? LCD_TX_LONG : 0));
 }
 
 void writeLCDData(unsigned char data)
 {
-    char lowWord = (data & 0x0F) << 4;
-    
-	// Send high value of the byte.
-    PORTD |= 0x04;
-    PORTD = (PORTD & 0x0F) | (data & 0xF0);
-    PORTD |= 0x08;
-    
-	// Send low value of the byte.
-    _delay_us(50);
-    PORTD &= 0xF7;
-    PORTD = (PORTD & 0x0F) | lowWord;
-    PORTD |= 0x08;
-    
-    _delay_us(50);
-    PORTD &= 0xF7;
+	queueLCD(data, LCD_TX_DATA);
+}
+
+// Framebuffer written by the UI and the copy of what the display currently shows.
+static char _lcdFrame[LCD_ROW_COUNT][LCD_MAX_ROW_LENGTH];
+static char _lcdShown[LCD_ROW_COUNT][LCD_MAX_ROW_LENGTH];
+
+static unsigned char _frameRow;
+static unsigned char _frameCol;
+
+// DDRAM address of the display cursor.
+static unsigned char _lcdAddress;
+
+static void setDisplayAddress(unsigned char addr)
+{
+	writeLCDCmd(0x80 | addr);
+	_lcdAddress = addr;
+}
+
+static void writeFrame(char data)
+{
+	// Characters beyond the end of the row are dropped.
+	if(_frameCol < LCD_MAX_ROW_LENGTH)
+	{
+		_lcdFrame[_frameRow][_frameCol++] = data;
+	}
 }
 
 void initLCD()
 {
-	// Try to reset the HD44780 controller.
-	_delay_ms(5);
-	writeLCDCmd(0x03);
-	_delay_ms(5);
-	writeLCDCmd(0x03);
-	_delay_ms(15);
-	writeLCDCmd(0x03);
-	
-	// Initialize display with default character set font size.
-	writeLCDCmd(0x02);
-	writeLCDCmd(0x02);
-	writeLCDCmd(0x08);
-	writeLCDCmd(0x00);
+#ifdef LCD_USE_BUSY_FLAG
+	LCD_RW_DDR |= LCD_RW_PIN;
+	LCD_RW_PORT &= ~LCD_RW_PIN;
+#endif
+	
+	// Timer2 in CTC mode with 8 prescaler clocks out one nibble per tick.
+	TCNT2 = 0x00;
+	OCR2 = (LCD_TICK_US / 2) - 1;
+	TCCR2 = (1 << WGM21) | (1 << CS21);
+	
+	// Reset HD44780 controller by instruction and switch to 4-bit interface. Whole sequence is queued,
+	// it runs in the background once interrupts are enabled.
+	queueLCD(0x30, LCD_TX_RESET);
+	queueLCD(0x30, LCD_TX_RESET);
+	queueLCD(0x30, LCD_TX_RESET);
+	queueLCD(0x20, LCD_TX_RESET);
+	
+	// 4-bit, 2 lines, 5x8 font / display on, cursor off / increment without shift.
+	writeLCDCmd(0x28);
 	writeLCDCmd(0x0C);
-	writeLCDCmd(0x00);
 	writeLCDCmd(0x06);
+	
+	// Clear display, both framebuffers start with blank rows.
+	writeLCDCmd(0x01);
+	
+	memset(_lcdFrame, ' ', sizeof(_lcdFrame));
+	memset(_lcdShown, ' ', sizeof(_lcdShown));
+	_lcdAddress = 0;
+	_frameRow = 0;
+	_frameCol = 0;
+}
+
+void flushLCD()
+{
+	unsigned char row, col, addr;
+	
+	// Send only the changed cells, cursor is moved only if the cell does not follow the previous one.
+	for(row = 0; row < LCD_ROW_COUNT; row++)
+	{
+		for(col = 0; col < LCD_MAX_ROW_LENGTH; col++)
+		{
+			if(_lcdFrame[row][col] == _lcdShown[row][col])
+			{
+				continue;
+			}
+			
+			addr = ((row == 0) ? 0x00 : 0x40) + col;
+			if(addr != _lcdAddress)
+			{
+				setDisplayAddress(addr);
+			}
+			
+			writeLCDData(_lcdFrame[row][col]);
+			_lcdShown[row][col] = _lcdFrame[row][col];
+			_lcdAddress++;
+		}
+	}
+}
+
+void setLCDDisplay(BOOL enable)
+{
+	// Display on / off with cursor off, DDRAM and the framebuffers are kept.
+	writeLCDCmd((enable == TRUE) ? 0x0C : 0x08);
 }
 
 void clearLCD()
 {
-	writeLCDCmd(0x00);
-	writeLCDCmd(0x01);	
+	memset(_lcdFrame, ' ', sizeof(_lcdFrame));
+	_frameRow = 0;
+	_frameCol = 0;
 }
 
 void setCursor(unsigned char row, unsigned char col)
 {
-	unsigned char cmd = (row == 1 ? 0x80 : 0xC0) + col - 1;
-	writeLCDCmd(cmd >> 4);
-	writeLCDCmd(cmd & 0x0F);
+	_frameRow = (row == 1) ? 0 : 1;
+	_frameCol = col - 1;
 }
 
 void clearRow(unsigned char row)
 {
-	unsigned char charPos;
-	setCursor(row, 1);
-	
-	for(charPos = 0; charPos < LCD_MAX_ROW_LENGTH; charPos++)
-	{
-		writeLCDData(' ');
-	}
-	
 	setCursor(row, 1);
+	memset(_lcdFrame[_frameRow], ' ', LCD_MAX_ROW_LENGTH);
 }
 
 void printStr(char *str)
 {
 	if(str != NULL)
 	{
-		unsigned char charPos;
-		
-		// Clamp specified string to 16 characters to support 16x2 LCD.
-		unsigned char maxPos = (strlen(str) > LCD_MAX_ROW_LENGTH) ? LCD_MAX_ROW_LENGTH : strlen(str);
-		for(charPos = 0; charPos < maxPos; charPos++)
+		// Clamp specified string to the end of the row to support 16x2 LCD.
+		while(*str)
 		{
-			writeLCDData(str[charPos]);
-		}	
+			writeFrame(*str++);
+		}
+	}
+}
+
+void printStr_P(const char *str)
+{
+	char c;
+	
+	// Constant strings stay in flash, SRAM is too small to hold them.
+	while((c = pgm_read_byte(str++)) != 0)
+	{
+		writeFrame(c);
 	}
 }
 
@@ -140,6 +383,6 @@ void drawLevel(unsigned char row, unsigned char level, BOOL positon)
 			charData = (pos == level) ? 0xFF : '-';
 		}
 		
-		writeLCDData(charData);
+		writeFrame(charData);
 	}
 }
\ No newline at end of file
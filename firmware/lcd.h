@@ -24,17 +24,53 @@
 #define LCD_H_
 
 #define LCD_MAX_ROW_LENGTH	16
+#define LCD_ROW_COUNT		2
+
+// Control lines on PORTD.
+#define LCD_RS_PIN			0x04
+#define LCD_E_PIN			0x08
+
+// HD44780 execution time of clear display and return home, all other instructions (37us) complete within one queue tick.
+#define LCD_EXEC_LONG_US	1520
+
+// Wait after each nibble of the reset sequence.
+#define LCD_EXEC_RESET_US	4100
+
+// Controller power-up time (VCC 2.7V), initLCD must not be called earlier.
+#define LCD_POWER_UP_MS		40
+
+// Instructions 0x01 - 0x03 are clear display and return home.
+#define LCD_CMD_HOME_MAX	0x03
+
+// Transmit queue size (power of 2) and interval of the queue timer, one nibble is sent per tick.
+// Changed row (cursor + 16 cells) overfills the queue by one entry, main waits ~100us for it.
+#define LCD_QUEUE_SIZE		16
+#define LCD_TICK_US			50
+
+// Define LCD_USE_BUSY_FLAG to poll the busy flag instead of the fixed delays.
+// R/W line of the LCD must be connected to LCD_RW_PIN of LCD_RW_PORT.
+#ifdef LCD_USE_BUSY_FLAG
+#define LCD_RW_PORT			PORTA
+#define LCD_RW_DDR			DDRA
+#define LCD_RW_PIN			0x01
+#define LCD_BUSY_FLAG		0x80
+#endif
 
 void writeLCDCmd(unsigned char cmd);
 void writeLCDData(unsigned char data);
 
 void initLCD();
+void flushLCD();
+BOOL isLCDIdle();
+void waitLCDIdle();
+void setLCDDisplay(BOOL enable);
 
 void clearLCD();
 void clearRow(unsigned char row);
 void setCursor(unsigned char row, unsigned char col);
 
 void printStr(char *str);
+void printStr_P(const char *str);
 void drawLevel(unsigned char row, unsigned char level, BOOL positon);
 
 #endif /* LCD_H_ */
\ No newline at end of file
@@ -23,20 +23,34 @@
 #include "global.h"
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <util/delay.h>
 
 #include "m62429.h"
 
-void updateVolumeControl(unsigned char level)
+// Precomputed 11-bit frames of levels 0 - 100: attenuation (MAX_VOLUME * level) / 100 with both channel select bits.
+static const unsigned short _volumeFrames[VOLUME_LEVELS] PROGMEM = 
+{
+	0x600, 0x600, 0x680, 0x700, 0x780, 0x604, 0x684, 0x704, 0x704, 0x784,
+	0x608, 0x688, 0x708, 0x788, 0x60C, 0x68C, 0x68C, 0x70C, 0x78C, 0x610,
+	0x690, 0x710, 0x790, 0x614, 0x614, 0x694, 0x714, 0x794, 0x618, 0x698,
+	0x718, 0x718, 0x798, 0x61C, 0x69C, 0x71C, 0x79C, 0x620, 0x6A0, 0x6A0,
+	0x720, 0x7A0, 0x624, 0x6A4, 0x724, 0x7A4, 0x628, 0x628, 0x6A8, 0x728,
+	0x7A8, 0x62C, 0x6AC, 0x72C, 0x72C, 0x7AC, 0x630, 0x6B0, 0x730, 0x7B0,
+	0x634, 0x6B4, 0x6B4, 0x734, 0x7B4, 0x638, 0x6B8, 0x738, 0x7B8, 0x63C,
+	0x63C, 0x6BC, 0x73C, 0x7BC, 0x640, 0x6C0, 0x740, 0x740, 0x7C0, 0x644,
+	0x6C4, 0x744, 0x7C4, 0x648, 0x6C8, 0x6C8, 0x748, 0x7C8, 0x64C, 0x6CC,
+	0x74C, 0x7CC, 0x650, 0x650, 0x6D0, 0x750, 0x7D0, 0x654, 0x6D4, 0x754,
+	0x7D4
+};
+
+static volatile unsigned char _volumeTarget;
+static unsigned char _volumeCurrent;
+
+static void sendVolumeFrame(unsigned char level)
 {
-	unsigned char  dbLevel = (MAX_VOLUME * level) / 100;
+	unsigned short outputData = pgm_read_word(&_volumeFrames[level]);
 	unsigned char dataPos;
-	unsigned short outputData = 0x00;
-	
-	outputData = 0;
-	outputData |= (dbLevel & 0x7C);
-	outputData |= (dbLevel & 0x03) << 7;
-	outputData |=  0x600; 
 	
 	// Submit data packet into M62429 controller.
 	for(dataPos = 0; dataPos < 11; dataPos++)
@@ -54,3 +68,39 @@ void updateVolumeControl(unsigned char level)
 	_delay_us(5);
 	PORTC &= 0x7F;
 }
+
+void initVolumeControl(unsigned char level)
+{
+	// Sent at once, used at boot before the volume tick is running and to mute in standby.
+	_volumeTarget = level;
+	_volumeCurrent = level;
+	sendVolumeFrame(level);
+}
+
+void updateVolumeControl(unsigned char level)
+{
+	// Only the latest target is kept, the volume tick ramps towards it.
+	_volumeTarget = (level < VOLUME_LEVELS) ? level : (VOLUME_LEVELS - 1);
+}
+
+void volumeTick()
+{
+	unsigned char target = _volumeTarget;
+	
+	if(_volumeCurrent == target)
+	{
+		return;
+	}
+	
+	// Move towards the target in small steps to avoid audible jumps.
+	if(_volumeCurrent < target)
+	{
+		_volumeCurrent = ((target - _volumeCurrent) > VOLUME_RAMP_STEP) ? (_volumeCurrent + VOLUME_RAMP_STEP) : target;
+	}
+	else
+	{
+		_volumeCurrent = ((_volumeCurrent - target) > VOLUME_RAMP_STEP) ? (_volumeCurrent - VOLUME_RAMP_STEP) : target;
+	}
+	
+	sendVolumeFrame(_volumeCurrent);
+}
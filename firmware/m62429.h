@@ -25,6 +25,12 @@
 
 #define MAX_VOLUME	87
 
+// Volume levels 0 - 100 and maximum level change per volumeTick call.
+#define VOLUME_LEVELS		101
+#define VOLUME_RAMP_STEP	2
+
+void initVolumeControl(unsigned char level);
 void updateVolumeControl(unsigned char level);
+void volumeTick();
 
 #endif /* M62429_H_ */
\ No newline at end of file
@@ -22,25 +22,29 @@
 
 #include "global.h"
 
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <avr/io.h>
-#include <util/delay.h>
 #include <avr/wdt.h>
+#include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 
 #include "main.h"
+#include "iic.h"
 #include "rda5807m.h"
 #include "lcd.h"
 #include "m62429.h"
 #include "storage.h"
+#include "scan.h"
+#include "af.h"
+#include "format.h"
+#include "sched.h"
+#include "encoder.h"
+#include "buttons.h"
+#include "events.h"
 
 int main()
 {
-	SYS_STATE lastState;
-	unsigned short memChannel;
-	
 	cli();
 	
 	initSystem();	
@@ -48,40 +52,64 @@ int main()
 	
 	// Setting up default values for the variables.
 	_currentState = TUNER_IDLE;
-	lastState = _currentState;
-	_lastButtonState = PINB;
+	_lastState = _currentState;
 	_clearRDSinfo = FALSE;
+	_startBandScan = FALSE;
+	_scanConfirm = FALSE;
+	_tuneSettled = FALSE;
+	_nameChannel = STORAGE_NO_CHANNEL;
 	_needUpdateUI = FALSE;
 	_updateSystemConfig = FALSE;
 	_idleLimit = IDLE_LIMIT_VOLUME;
-	_lastEncorderButtonVal = 0xFF;
 	_memoryStoredFlag = 0;
 	_memAction = MA_NONE;
+	_seekAction = SA_NONE;
 	_defaultMemChannel = 0;
+	_inactiveTicks = 0;
+	_inactiveMinutes = 0;
+	_wakeButtons = 0;
 
 	memset(_lcdRow1, 0, LCD_MAX_ROW_LENGTH + 1);
 	memset(_lcdRow2, 0, LCD_MAX_ROW_LENGTH + 1);
+	resetRDSData(&_rdsData);
 	
-	memset(_memoryHoldCounter, 0, MEM_GROUP_SIZE);
+	// Setup timer1 to generate the 1ms system tick (which also samples the rotary encoder and buttons), boot times are measured from here.
+	initEncoder();
+	initButtons();
+	initScheduler();
+	_bootAudioTicks = 0;
+	_bootDisplayTicks = 0;
+	sei();
 	
-	_delay_ms(1000);
-	clearRDSData(_stationTempBuffer, _stationName, MAX_STATION_NAME_SIZE);
+	// Load last system configuration while the LCD controller and the receiver are powering up.
+	loadConfig(&_currentConfig);
 	
-	initReceiver();
-	_delay_ms(10);
+	// Both power-up waits run in parallel.
+	while(getSystemTicks() < BOOT_POWER_UP_MS);
 	
-	// Load and restore last system configuration.
-	loadConfig(&_currentConfig);
-	updateChannel(_currentConfig.currentChannel);
-	_delay_ms(20);
+	// LCD reset and clear run in the background from the timer2 queue.
+	initLCD();
+	
+	// Receiver leaves the reset already tuned to the saved channel, volume ramps up from mute.
+	initReceiver(_currentConfig.currentChannel);
 	updateVolumeControl(_currentConfig.volume);
-	_delay_ms(10);
 	
-	clearLCD();
+	// Controller reset and clear display (1.52ms) complete before the tasks queue the first screen.
+	waitLCDIdle();
 	
-	// Setup timer1 to generate interrupts with 100ms intervals.
-	initButtonScanner();
-	sei();
+	// Register the service tasks.
+	addTask(encoderTask, ENCODER_TASK_MS, 0);
+	addTask(scanTask, SCAN_POLL_MS, 0);
+	addTask(tunerTask, TUNER_TASK_MS, 0);
+	addTask(rdsTask, RDS_TASK_MS, (RDS_TASK_MS / 2));
+	addTask(volumeTask, VOLUME_TASK_MS, 0);
+	addTask(uiTask, UI_TASK_MS, 5);
+	addTask(inputTask, INPUT_TASK_MS, 0);
+	addTask(timeoutTask, TIMEOUT_TASK_MS, 0);
+	addTask(storageTask, STORAGE_TASK_MS, (STORAGE_TASK_MS / 2));
+	_scanReportTimer = addTimer(scanReportDone);
+	
+	enableRDSCapture(TRUE);
 	
 	// Enable watchdog timer with 2.1 seconds time configuration.
 	wdt_enable(WDTO_1S);
@@ -95,235 +123,591 @@ int main()
 		// Reset watchdog timer.
 		wdt_reset();
 		
-		if(_currentState == TUNER_IDLE)
+		// Run the due tasks, CPU idles until the next tick if nothing is due.
+		runScheduler();
+	}
+	
+	return 0;
+}
+
+void tunerTask()
+{
+	unsigned short memChannel;
+	
+	// Handle tuner information processing.
+	if(_currentState != TUNER_IDLE)
+	{
+		return;
+	}
+	
+	// Queue status read, it completes in background while the rest of the UI is processed.
+	requestConfiguration();
+	
+	// Handle screen transitions.
+	if(_lastState != TUNER_IDLE)
+	{
+		clearLCD();
+		enableRDSCapture(TRUE);
+		_nameChannel = STORAGE_NO_CHANNEL;
+		_tuneSettled = FALSE;
+		_lastState = TUNER_IDLE;
+	}
+	
+	// Long press of TUNE UP starts the band scan.
+	if(_startBandScan == TRUE)
+	{
+		_startBandScan = FALSE;
+		enterBandScan();
+		return;
+	}
+	
+	// Start or abort the seek requested by the user.
+	if(_seekAction == SA_ABORT)
+	{
+		abortSeek();
+	}
+	else if(_seekAction != SA_NONE)
+	{
+		startSeekControl(((_seekAction == SA_UP) ? SKMODE_UP : SKMODE_DOWN), _currentConfig.currentChannel, TRUE);
+		_clearRDSinfo = TRUE;
+		_updateSystemConfig = TRUE;
+	}
+	
+	_seekAction = SA_NONE;
+	
+	// Memory actions cancel the running seek.
+	if(_memAction != MA_NONE)
+	{
+		abortSeek();
+	}
+	
+	// Perform memory recall and save operations based on user actions.
+	if(_memAction == MA_LOAD)
+	{
+		memChannel = loadMemorySlot(_defaultMemChannel);
+		if(memChannel != _currentConfig.currentChannel)
 		{
-			// Handle tuner information processing and RDS routines.
-			
-			// Handle screen transitions.
-			if(lastState != TUNER_IDLE)
+			updateChannel(memChannel);
+			_clearRDSinfo = TRUE;
+			_updateSystemConfig = TRUE;
+		}
+		
+		_memAction = MA_NONE;
+	}
+	else if(_memAction == MA_SAVE)
+	{
+		if(saveMemoryStation(_defaultMemChannel, _currentConfig.currentChannel) == TRUE)
+		{
+			_memoryStoredFlag = 1;
+		}
+		
+		_memAction = MA_NONE;
+	}
+	
+	// Read status bits from receiver and extract tuner information.
+	readConfiguration(_receiverInfo);
+	extractFrequency(_receiverInfo[0], _lcdRow1);
+	
+	setCursor(1,1);
+	printStr(_lcdRow1);
+	
+	// Handle RDS clear flag raised by the input handlers.
+	if(_clearRDSinfo == TRUE)
+	{
+		// Clear current RDS data and the groups captured from the previous channel.
+		resetRDSData(&_rdsData);
+		flushRDSGroups();
+		resetAFTable();
+		clearRow(2);
+		
+		_nameChannel = STORAGE_NO_CHANNEL;
+		_tuneSettled = FALSE;
+		_clearRDSinfo = FALSE;
+		return;
+	}
+	
+	// Update stereo indicator.
+	PORTD &= 0xFE;
+	if((_receiverInfo[0] & RDA5807_STEREO) != 0x00)
+	{
+		PORTD |= 0x01;
+	}
+	
+	// Check current status of the tunning process, seek controller skips the false stops.
+	if(((_receiverInfo[0] & RDA5807_SEEK_TUNE_COMPLETE) == 0) || (serviceSeek(_receiverInfo) == TRUE))
+	{
+		// Groups captured during seek or tune belong to other channels.
+		flushRDSGroups();
+		_tuneSettled = FALSE;
+	}
+	else
+	{
+		_tuneSettled = TRUE;
+		
+		// Boot to audio time, first tune after the boot is complete.
+		if(_bootAudioTicks == 0)
+		{
+			_bootAudioTicks = getSystemTicks();
+		}
+		
+		// Update current channel information in EEPROM.
+		if(_updateSystemConfig == TRUE)
+		{
+			_currentConfig.currentChannel = _receiverInfo[0] & RDA5807_CHANNEL_INFO;
+			saveReceiverChannel(&_currentConfig);
+		}
+	}
+	
+	// Display "STORED" message during the channel preset.
+	if(_memoryStoredFlag > 0)
+	{
+		setCursor(2, 1);
+		printStr_P(PSTR("STORED        "));
+	}
+}
+
+void rdsTask()
+{
+	unsigned char rdsUpdate;
+	
+	// RDS groups are processed only on a settled channel of the tuner screen.
+	if((_currentState != TUNER_IDLE) || (_lastState != TUNER_IDLE) || (_tuneSettled == FALSE))
+	{
+		return;
+	}
+	
+	// Show the cached name of the new channel until the live PS is received.
+	if((_receiverInfo[0] & RDA5807_CHANNEL_INFO) != _nameChannel)
+	{
+		showStationName(_receiverInfo[0] & RDA5807_CHANNEL_INFO);
+	}
+	
+	// Drain captured RDS groups and show station name once all segments are received.
+	rdsUpdate = 0;
+	while(readRDSGroup(&_rdsGroup) == TRUE)
+	{
+		// Groups of an AF candidate reach the decoder only after its PI matches the current program.
+		if(screenAFGroup(&_rdsGroup) == FALSE)
+		{
+			rdsUpdate |= decodeRDSGroup(&_rdsData, &_rdsGroup);
+		}
+	}
+	
+	// Cached name belongs to another program, remove it from the screen and the cache.
+	if((rdsUpdate & RDS_FIELD_PI) && (_nameCached == TRUE) && (_rdsData.pi != _namePI))
+	{
+		dropStationName(_nameChannel);
+		_nameCached = FALSE;
+		
+		if(!(_rdsData.valid & RDS_FIELD_PS))
+		{
+			clearRow(2);
+		}
+	}
+	
+	// Learn the name once per tune, dynamic PS texts do not wear the EEPROM.
+	if((rdsUpdate & RDS_FIELD_PS_STABLE) && (_rdsData.valid & RDS_FIELD_PI) && (_nameStored == FALSE))
+	{
+		saveStationName(_nameChannel, _rdsData.pi, _rdsData.ps);
+		_nameStored = TRUE;
+	}
+	
+	if(rdsUpdate & RDS_FIELD_AF)
+	{
+		updateAFTable(&_rdsData, (_receiverInfo[0] & RDA5807_CHANNEL_INFO));
+	}
+	
+	// Follow alternative frequency of the current program if the signal fades, new channel is saved once its PI is confirmed.
+	if(serviceAF(_receiverInfo, &_rdsData) == TRUE)
+	{
+		_tuneSettled = FALSE;
+		_updateSystemConfig = TRUE;
+	}
+	
+	if((rdsUpdate & RDS_FIELD_PS) && (_memoryStoredFlag == 0))
+	{
+		setCursor(2, 1);
+		memset(_lcdRow2, ' ', LCD_MAX_ROW_LENGTH);
+		strcpy(_lcdRow2, _rdsData.ps);
+		printStr(_lcdRow2);
+	}
+}
+
+void encoderTask()
+{
+	signed short encoderPos;
+	signed short steps = readEncoder();
+	
+	if(steps != 0)
+	{
+		_inactiveTicks = 0;
+		_inactiveMinutes = 0;
+	}
+	
+	if(_currentState == STANDBY)
+	{
+		// Rotary encoder wakes the system up from the standby.
+		if(steps != 0)
+		{
+			exitStandby();
+		}
+		
+		return;
+	}
+	
+	if(_currentState == TUNER_IDLE)
+	{
+		// Check for rotary encoder rotations.
+		if(steps != 0)
+		{
+			enterVolumeControl();
+		}
+		
+		return;
+	}
+	
+	if((_currentState != VOLUME_CONTROL) && (_currentState != TUNER_CONTROL))
+	{
+		return;
+	}
+	
+	// Handle screen transitions.
+	if(_lastState != _currentState)
+	{
+		abortSeek();
+		clearLCD();
+		
+		if(_currentState == VOLUME_CONTROL)
+		{
+			printStr_P(PSTR("VOLUME: "));
+		}
+		
+		_lastState = _currentState;
+	}
+	
+	if(_currentState == TUNER_CONTROL)
+	{
+		// Handle manual tunning.
+		if(_indicatorCounter == 0)
+		{
+			readConfigurationFast(_receiverInfo);
+						
+			// Update stereo indicator.
+			PORTD &= 0xFE;
+			if((_receiverInfo[0] & RDA5807_STEREO) != 0x00)
 			{
-				clearLCD();
-				lastState = TUNER_IDLE;
-			}
+				PORTD |= 0x01;
+			}	
+		}
+		
+		if((++_indicatorCounter) >= INDICATOR_TASK_RUNS)
+		{
+			_indicatorCounter = 0;
+		}
+	}
+	
+	// Apply the (accelerated) steps collected by the encoder sampler.
+	if(steps != 0)
+	{
+		encoderPos = (signed short)_rotaryEncoderPos + steps;
+		if(encoderPos < 0)
+		{
+			encoderPos = 0;
+		}
+		else if(encoderPos > ((_currentState == VOLUME_CONTROL) ? 100 : 210))
+		{
+			encoderPos = (_currentState == VOLUME_CONTROL) ? 100 : 210;
+		}
+		
+		if(encoderPos != _rotaryEncoderPos)
+		{
+			_rotaryEncoderPos = encoderPos;
+			_needUpdateUI = TRUE;
 			
-			// Perform memory recall and save operations based on user actions.
-			if(_memAction == MA_LOAD)
-			{
-				memChannel = loadMemorySlot(_defaultMemChannel);
-				if(memChannel != _currentConfig.currentChannel)
-				{
-					updateChannel(memChannel);
-					_clearRDSinfo = TRUE;
-					_updateSystemConfig = TRUE;
-				}
-				
-				_memAction = MA_NONE;
-			}
-			else if(_memAction == MA_SAVE)
+			// Screen shows the target at once, the receiver is tuned to the latest target only.
+			if(_currentState == TUNER_CONTROL)
 			{
-				if(saveMemoryStation(_defaultMemChannel, _currentConfig.currentChannel) == TRUE)
-				{
-					_memoryStoredFlag = 1;
-				}
-				
-				_memAction = MA_NONE;
+				requestTune(_rotaryEncoderPos);
 			}
+		}
+	}
+	
+	if(_currentState == TUNER_CONTROL)
+	{
+		serviceTune();
+	}
+}
+
+void uiTask()
+{
+	// Update volume or tuner information in the screen once the screen transition is done.
+	if((_needUpdateUI == TRUE) && (_lastState == _currentState))
+	{
+		if(_currentState == VOLUME_CONTROL)
+		{
+			// Draw new values into the screen
+			strcpy_P(&_lcdRow1[formatNumber(_rotaryEncoderPos, _lcdRow1)], PSTR("  "));
+			setCursor(1, 9);
+			printStr(_lcdRow1);
+			drawLevel(2, ((_rotaryEncoderPos * (LCD_MAX_ROW_LENGTH - 1)) / 100), FALSE);
 			
-			// Read status bits from receiver and extract tuner information.
-			readConfiguration(_receiverInfo);
-			extractFrequency(_receiverInfo[0], _lcdRow1);
+			// Send volume information to the controller and EEPROM.
+			updateVolumeControl(_rotaryEncoderPos);
+			_currentConfig.volume = _rotaryEncoderPos;
+			saveVolume(&_currentConfig);
+		}
+		else if(_currentState == TUNER_CONTROL)
+		{
+			extractFrequency(_rotaryEncoderPos, _lcdRow1);
 			
 			setCursor(1,1);
 			printStr(_lcdRow1);
-			
-			// Handle RDS clear flag raised in ISR.
-			if(_clearRDSinfo == TRUE)
+			drawLevel(2, ((_rotaryEncoderPos * (LCD_MAX_ROW_LENGTH - 1)) / 210), TRUE);
+		}
+		
+		_idleCounter = 0;
+		_needUpdateUI = FALSE;
+	}
+	
+	// Send the cells changed by the other tasks to the display.
+	flushLCD();
+	
+	// Boot to display time, the first tuner screen is out once the queue drains (UI task period resolution).
+	if((_bootDisplayTicks == 0) && (_lastState == TUNER_IDLE) && (isLCDIdle() == TRUE))
+	{
+		_bootDisplayTicks = getSystemTicks();
+	}
+}
+
+void scanTask()
+{
+	unsigned char scanPos;
+	
+	if(_currentState != BAND_SCAN)
+	{
+		return;
+	}
+	
+	// Handle screen transitions.
+	if(_lastState != BAND_SCAN)
+	{
+		clearLCD();
+		printStr_P(PSTR("SCANNING..."));
+		_lastState = BAND_SCAN;
+	}
+	
+	// Scan result is on the screen until the report timer expires.
+	if(isTimerActive(_scanReportTimer) == TRUE)
+	{
+		return;
+	}
+	
+	if(serviceBandScan() == FALSE)
+	{
+		// Report the scan result, stations found by the scan replace the presets only if the user confirms it.
+		strcpy_P(_lcdRow1, PSTR("FOUND "));
+		scanPos = 6 + formatNumber(scanResult.count, &_lcdRow1[6]);
+		_lcdRow1[scanPos++] = ' ';
+		strcpy_P(&_lcdRow1[scanPos + formatNumber(getScanTime(), &_lcdRow1[scanPos])], PSTR("ms"));
+		clearRow(1);
+		printStr(_lcdRow1);
+		
+		if(scanResult.count > 0)
+		{
+			clearRow(2);
+			printStr_P(PSTR("STORE? PUSH=YES"));
+			_scanConfirm = TRUE;
+			startTimer(_scanReportTimer, SCAN_CONFIRM_MS, 0);
+		}
+		else
+		{
+			startTimer(_scanReportTimer, SCAN_REPORT_MS, 0);
+		}
+	}
+}
+
+void confirmAutoStore(BOOL store)
+{
+	unsigned char storeCount;
+	
+	_scanConfirm = FALSE;
+	
+	if(store == FALSE)
+	{
+		// Declined, presets are kept and the tuner screen returns at once.
+		startTimer(_scanReportTimer, 0, 0);
+		return;
+	}
+	
+	// Store strongest stations into the presets.
+	storeCount = autoStoreStations(MEM_GROUP_SIZE);
+	strcpy_P(_lcdRow2, PSTR("STORED "));
+	formatNumber(storeCount, &_lcdRow2[7]);
+	clearRow(2);
+	printStr(_lcdRow2);
+	
+	startTimer(_scanReportTimer, SCAN_REPORT_MS, 0);
+}
+
+void scanReportDone()
+{
+	// Confirmation prompt without an answer keeps the presets.
+	_scanConfirm = FALSE;
+	_clearRDSinfo = TRUE;
+	exitSubSystem();
+}
+
+void storageTask()
+{
+	// Abort stalled background I2C transfers.
+	twiTick();
+	
+	// Start EEPROM write-back once the stored values are quiet.
+	storageTick();
+}
+
+void volumeTask()
+{
+	// Ramp volume towards the latest requested level.
+	volumeTick();
+}
+
+void inputTask()
+{
+	unsigned char event, memPos;
+	unsigned short button;
+	
+	// Button events posted by the debouncer, all actions are executed in the main context.
+	while(readEvent(&event) == TRUE)
+	{
+		button = 1 << EVENT_ARG(event);
+		_inactiveTicks = 0;
+		_inactiveMinutes = 0;
+		
+		// Any button wakes the system up from the standby.
+		if(_currentState == STANDBY)
+		{
+			if(EVENT_TYPE(event) == EV_BUTTON_PRESS)
 			{
-				// Clear current RDS data.
-				clearRDSData(_stationTempBuffer, _stationName, MAX_STATION_NAME_SIZE);
-				clearRow(2);
-				
-				_clearRDSinfo = FALSE;
-				_delay_ms(25);
-				continue;
+				_wakeButtons |= button;
+				exitStandby();
 			}
 			
-			// Update stereo indicator.
-			PORTD &= 0xFE;
-			if((_receiverInfo[0] & RDA5807_STEREO) != 0x00)
+			continue;
+		}
+		
+		// Button which woke the system up is ignored until it is pressed again.
+		if(button & _wakeButtons)
+		{
+			if(EVENT_TYPE(event) != EV_BUTTON_PRESS)
 			{
-				PORTD |= 0x01;
+				continue;
 			}
 			
-			// Check current status of the tunning process.
-			if((_receiverInfo[0] & RDA5807_SEEK_TUNE_COMPLETE) != 0)
+			_wakeButtons &= ~button;
+		}
+		
+		// Handle tuner related user events.
+		if(_currentState == TUNER_IDLE)
+		{
+			if(EVENT_TYPE(event) == EV_BUTTON_RELEASE)
 			{
-				// Extract RDS data if station is available.
-				if((extractRDSData(_receiverInfo, _stationTempBuffer, _stationName) == TRUE) && (_memoryStoredFlag == 0))
+				// Short press of TUNE UP / DOWN starts or aborts the seek.
+				if(button & (BUTTON_TUNE_UP | BUTTON_TUNE_DOWN))
 				{
-					setCursor(2, 1);
-					memset(_lcdRow2, ' ', LCD_MAX_ROW_LENGTH);
-					strcpy(_lcdRow2, _stationName);
-					printStr(_lcdRow2);
+					_seekAction = (isSeekRunning() == TRUE) ? SA_ABORT : ((button == BUTTON_TUNE_UP) ? SA_UP : SA_DOWN);
 				}
-				
-				// Update current channel information in EEPROM.
-				if(_updateSystemConfig == TRUE)
+				else if(button == BUTTON_ROTARY)
 				{
-					_currentConfig.currentChannel = _receiverInfo[0] & RDA5807_CHANNEL_INFO;
-					saveReceiverChannel(&_currentConfig);
+					enterTunerControl();
 				}
 			}
-			
-			// Display "STORED" message during the channel preset.
-			if(_memoryStoredFlag > 0)
+			else if((EVENT_TYPE(event) == EV_BUTTON_LONG) && (button == BUTTON_TUNE_UP))
 			{
-				setCursor(2, 1);
-				printStr("STORED        ");
+				// Long press of TUNE UP is reserved for the band scan.
+				_startBandScan = TRUE;
 			}
-			
-			// Check for rotary encoder rotations.
-			if((PINC & 0x30) != 0x30)
-			{
-				enterVolumeControl();
-			}
-						
-			_delay_ms(20);
-		}
-		else if(_currentState == VOLUME_CONTROL)
-		{
-			// Handle rotary encoder related events
-			_memAction = MA_NONE;
-			
-			// Handle screen transitions.
-			if(lastState != VOLUME_CONTROL)
+			else if((EVENT_TYPE(event) == EV_BUTTON_LONG) && (button == BUTTON_TUNE_DOWN))
 			{
-				clearLCD();
-				printStr("VOLUME: ");
-				lastState = VOLUME_CONTROL;
+				// Long press of TUNE DOWN switches to the standby.
+				enterStandby();
+				continue;
 			}
 			
-			// Check for rotary encoder rotations.
-			if((PINC & 0x30) != 0x30)
+			// Long press stores the current channel, short press loads the programmed channel.
+			for(memPos = 0; memPos < MEM_GROUP_SIZE; memPos++)
 			{
-				if((!(PINC & 0x10)) && (_lastEncoderVal))
+				if(button == _memoryButtonGroup[memPos])
 				{
-					if(PINC & 0x20)
+					if(EVENT_TYPE(event) == EV_BUTTON_LONG)
 					{
-						if(_rotaryEncoderPos < 100)
-						{
-							_rotaryEncoderPos++;
-							_needUpdateUI = TRUE;
-						}
+						_defaultMemChannel = memPos;
+						_memAction = MA_SAVE;
 					}
-					else
+					else if(EVENT_TYPE(event) == EV_BUTTON_RELEASE)
 					{
-						if(_rotaryEncoderPos > 0)
-						{
-							_rotaryEncoderPos--;
-							_needUpdateUI = TRUE;
-						}
+						_defaultMemChannel = memPos;
+						_memAction = MA_LOAD;
 					}
 				}
 			}
-			
-			// Update volume information in both UI and controller.
-			if(_needUpdateUI == TRUE)
-			{
-				// Draw new values into the screen
-				sprintf(_lcdRow1, "%d  ", _rotaryEncoderPos);
-				setCursor(1, 9);
-				printStr(_lcdRow1);
-				drawLevel(2, ((_rotaryEncoderPos * (LCD_MAX_ROW_LENGTH - 1)) / 100), FALSE);
-				
-				// Send volume information to the controller and EEPROM.
-				updateVolumeControl(_rotaryEncoderPos);
-				_currentConfig.volume = _rotaryEncoderPos;
-				saveVolume(&_currentConfig);
-				
-				_idleCounter = 0;
-				_needUpdateUI = FALSE;
-			}
-			
-			_lastEncoderVal = (PINC & 0x10);
-			_delay_us(750);
 		}
-		else if(_currentState == TUNER_CONTROL)
+		else if((_currentState == BAND_SCAN) && (_scanConfirm == TRUE))
 		{
-			// Handle manual tunning.
-			if(_indicatorCounter == 0)
+			// Rotary button stores the scan result, any panel button declines it.
+			if((EVENT_TYPE(event) == EV_BUTTON_RELEASE) && (button == BUTTON_ROTARY))
 			{
-				readConfigurationFast(_receiverInfo);
-							
-				// Update stereo indicator.
-				PORTD &= 0xFE;
-				if((_receiverInfo[0] & RDA5807_STEREO) != 0x00)
-				{
-					PORTD |= 0x01;
-				}	
+				confirmAutoStore(TRUE);
 			}
-			
-			_indicatorCounter++;
-			
-			// Handle screen transitions.
-			if(lastState != TUNER_CONTROL)
+			else if((EVENT_TYPE(event) == EV_BUTTON_PRESS) && (button & BUTTON_PANEL_MASK))
 			{
-				clearLCD();
-				lastState = TUNER_CONTROL;
+				confirmAutoStore(FALSE);
 			}
-			
-			// Check for rotary encoder rotations.
-			if((PINC & 0x30) != 0x30)
+		}
+		else if((_currentState == VOLUME_CONTROL) || (_currentState == TUNER_CONTROL))
+		{
+			if((EVENT_TYPE(event) == EV_BUTTON_PRESS) && (button & BUTTON_PANEL_MASK))
 			{
-				if((!(PINC & 0x10)) && (_lastEncoderVal))
-				{
-					if(PINC & 0x20)
-					{
-						if(_rotaryEncoderPos < 210)
-						{
-							updateChannel(++_rotaryEncoderPos);
-							_needUpdateUI = TRUE;
-						}
-					}
-					else
-					{
-						if(_rotaryEncoderPos > 0)
-						{
-							updateChannel(--_rotaryEncoderPos);
-							_needUpdateUI = TRUE;
-						}
-					}
-				}
+				// Any panel button switches UI to the default (tuner).
+				exitSubSystem();
 			}
-			
-		
-			// Update current tuner information in the screen.
-			if(_needUpdateUI == TRUE)
+			else if((EVENT_TYPE(event) == EV_BUTTON_RELEASE) && (button == BUTTON_ROTARY))
 			{
-				extractFrequency(_rotaryEncoderPos, _lcdRow1);
-				
-				setCursor(1,1);
-				printStr(_lcdRow1);
-				drawLevel(2, ((_rotaryEncoderPos * (LCD_MAX_ROW_LENGTH - 1)) / 210), TRUE);
-
-				_idleCounter = 0;
-				_needUpdateUI = FALSE;
+				// Check for rotary button press event.
+				if(_currentState == VOLUME_CONTROL)
+				{
+					enterTunerControl();
+				}
+				else
+				{
+					enterVolumeControl();
+				}
 			}
-
-			_lastEncoderVal = (PINC & 0x10);
-			_delay_us(100);
 		}
 	}
-	
-	return 0;
 }
 
-ISR (TIMER1_COMPA_vect)
+void timeoutTask()
 {
-	unsigned char memPos;
+	// Keep the last duty cycle measurement of the active and standby modes.
+	if(_currentState == STANDBY)
+	{
+		_standbyDuty = schedStats.duty;
+	}
+	else
+	{
+		_activeDuty = schedStats.duty;
+	}
 	
-	// Reset watchdog timer.
-	wdt_reset();
+	// Inactivity on the tuner screen switches to the standby.
+	if((_currentState == TUNER_IDLE) && ((++_inactiveTicks) >= TIMEOUT_TASK_RUNS_MIN))
+	{
+		_inactiveTicks = 0;
+		if((++_inactiveMinutes) >= STANDBY_IDLE_MINUTES)
+		{
+			enterStandby();
+		}
+	}
 	
 	// Reset memory stored flag after nearly 1 seconds.
 	if(_memoryStoredFlag > 0)
@@ -334,131 +718,88 @@ ISR (TIMER1_COMPA_vect)
 		}
 	}
 	
-	// Handle tuner related user events.
-	if(_currentState == TUNER_IDLE)
-	{
-		// Check for TUNE UP button event.
-		if(((_lastButtonState & BUTTON_TUNE_UP) == 0x00) && ((PINB & BUTTON_TUNE_UP) == BUTTON_TUNE_UP))
-		{
-			startSeek(SKMODE_UP);
-			_clearRDSinfo = TRUE;
-			_updateSystemConfig = TRUE;
-		}
-		
-		// Check for TUNE DOWN button event.
-		if(((_lastButtonState & BUTTON_TUNE_DOWN) == 0x00) && ((PINB & BUTTON_TUNE_DOWN) == BUTTON_TUNE_DOWN))
-		{
-			startSeek(SKMODE_DOWN);
-			_clearRDSinfo = TRUE;
-			_updateSystemConfig = TRUE;
-		}
-		
-		// Check for rotary button press event.
-		if(((_lastEncorderButtonVal & ROTARY_BUTTON) == 0x00) && ((PINC & ROTARY_BUTTON) == ROTARY_BUTTON))
-		{
-			enterTunerControl();
-			return;
-		}
-	
-		// Check for memory recall action.
-		for(memPos = 0; memPos < MEM_GROUP_SIZE; memPos++)
-		{
-			// Count hold down times of the memory buttons.
-			if(((PINB & _memoryButtonGroup[memPos]) == 0x00) && (_memoryHoldCounter[memPos] < 0xFF))
-			{
-				_memoryHoldCounter[memPos]++;
-			}
-			
-			// Check for hold down timeout to store the current channel.
-			if(_memoryHoldCounter[memPos] >= LONG_PRESS_COUNTS)
-			{
-				_memoryHoldCounter[memPos] = 0;
-				_defaultMemChannel = memPos;
-				_memAction = MA_SAVE;
-				return;
-			}
-			
-			// On normal button action load programmed channel from memory.
-			if(((_lastButtonState & _memoryButtonGroup[memPos]) == 0x00) && ((PINB & _memoryButtonGroup[memPos]) == _memoryButtonGroup[memPos]))
-			{
-				_defaultMemChannel = memPos;
-				_memAction = MA_LOAD;
-				_memoryHoldCounter[memPos] = 0;
-			}
-			
-			// Reset memory hold down counter on idle state.
-			if((PINB & _memoryButtonGroup[memPos])	== _memoryButtonGroup[memPos])
-			{
-				_memoryHoldCounter[memPos] = 0;	
-			}	
-		}
-				
-		_lastButtonState = PINB;
-	}
-	else if((_currentState == VOLUME_CONTROL) || (_currentState == TUNER_CONTROL))
+	if((_currentState == VOLUME_CONTROL) || (_currentState == TUNER_CONTROL))
 	{
-		unsigned char idleTimeout;
-		
 		if(_idleCounter < 0xFF)
 		{
 			_idleCounter++;
 		}
 		
-		idleTimeout = ((_idleCounter >= _idleLimit) && ((PINC & 0x30) == 0x30));
-
-		if(idleTimeout || ((PINB & 0xFF) != 0xFF))
+		if((_idleCounter >= _idleLimit) && (isEncoderIdle() == TRUE))
 		{
 			// Sub system time-out. Switch UI to the default (tuner).
 			exitSubSystem();
 		}
-		
-		if(((_lastEncorderButtonVal & ROTARY_BUTTON) == 0x00) && ((PINC & ROTARY_BUTTON) == ROTARY_BUTTON))
-		{
-			// Check for rotary button press event.
-			if(_currentState == VOLUME_CONTROL)
-			{
-				enterTunerControl();
-			}
-			else
-			{
-				enterVolumeControl();
-			}
-			
-			return;
-		}
 	}
-	
-	_lastEncorderButtonVal = PINC;
 }
 
 void enterVolumeControl()
 {
+	flushTune();
+	enableRDSCapture(FALSE);
 	_rotaryEncoderPos = _currentConfig.volume;
 	_idleCounter = 0;
 	_idleLimit = IDLE_LIMIT_VOLUME;
-	_lastEncoderVal = (PINC & 0x10);
-	_lastEncorderButtonVal = 0xFF;
+	clearEncoder();
 	_needUpdateUI = TRUE;
 	_currentState = VOLUME_CONTROL;
 }
 
 void enterTunerControl()
 {
+	enableRDSCapture(FALSE);
 	PORTD &= 0xFE;
 	_rotaryEncoderPos = _currentConfig.currentChannel;
 	_idleCounter = 0;
 	_indicatorCounter = 0;
 	_idleLimit = IDLE_LIMIT_TUNER;
-	_lastEncoderVal = (PINC & 0x10);
-	_lastEncorderButtonVal = 0xFF;
+	clearEncoder();
 	_needUpdateUI = TRUE;
 	_currentState = TUNER_CONTROL;
 }
 
+void showStationName(unsigned short channel)
+{
+	_nameChannel = channel;
+	_nameCached = FALSE;
+	_nameStored = FALSE;
+	
+	// After AF switches the decoded PS is still valid, otherwise use the cached name of the channel.
+	if(_rdsData.valid & RDS_FIELD_PS)
+	{
+		strcpy(_lcdRow2, _rdsData.ps);
+	}
+	else if(findStationName(channel, &_namePI, _lcdRow2) == TRUE)
+	{
+		_lcdRow2[RDS_PS_LENGTH] = 0;
+		_nameCached = TRUE;
+	}
+	else
+	{
+		return;
+	}
+	
+	if(_memoryStoredFlag == 0)
+	{
+		setCursor(2, 1);
+		printStr(_lcdRow2);
+	}
+}
+
+void enterBandScan()
+{
+	abortSeek();
+	enableRDSCapture(FALSE);
+	PORTD &= 0xFE;
+	startBandScan(_currentConfig.currentChannel);
+	_currentState = BAND_SCAN;
+}
+
 void exitSubSystem()
 {
 	if(_currentState == TUNER_CONTROL)
 	{
+		flushTune();
 		_clearRDSinfo = (_rotaryEncoderPos != _currentConfig.currentChannel) ? TRUE : FALSE;
 		_currentConfig.currentChannel = _rotaryEncoderPos;
 		
@@ -467,25 +808,47 @@ void exitSubSystem()
 	}
 	
 	_idleCounter = 0;
-	_lastButtonState = 0xFF;
 	_needUpdateUI = FALSE;
 	_currentState = TUNER_IDLE;
 }
 
-void setConfigDefault(SYS_CONFIG *config)
+void enterStandby()
 {
-	config->volume = DEFAULT_VOLUME;
-	config->currentChannel = DEFAULT_CHANNEL;
+	abortSeek();
+	enableRDSCapture(FALSE);
+	
+	// Mute at once, then power down the tuner, display and back-light.
+	initVolumeControl(0);
+	powerDownReceiver();
+	setLCDDisplay(FALSE);
+	PORTD &= 0xFC;
+	
+	// Pending configuration is written before the unit goes quiet.
+	flushStorage();
+	
+	_inactiveTicks = 0;
+	_inactiveMinutes = 0;
+	_currentState = STANDBY;
+	_lastState = STANDBY;
 }
 
-void initButtonScanner()
+void exitStandby()
 {
-	TCNT1 = 0x00;
-	TCCR1A = 0x00;
-	TCCR1B = 0x0A;
-	OCR1AH = 0xC3;
-	OCR1AL = 0x4F;
-	TIMSK = (1 << OCIE1A);
+	// Resume on the last channel without the receiver initialization, volume ramps up to the saved level.
+	powerUpReceiver(_currentConfig.currentChannel);
+	updateVolumeControl(_currentConfig.volume);
+	setLCDDisplay(TRUE);
+	PORTD |= 0x02;
+	
+	// Tuner screen transition restarts the RDS capture.
+	_clearRDSinfo = TRUE;
+	_currentState = TUNER_IDLE;
+}
+
+void setConfigDefault(SYS_CONFIG *config)
+{
+	config->volume = DEFAULT_VOLUME;
+	config->currentChannel = DEFAULT_CHANNEL;
 }
 
 void initSystem()
@@ -496,6 +859,9 @@ void initSystem()
 	// Disable UART and all it's I/O pins.
 	UCSRB = 0x00;
 	UCSRA = 0x00;
+	
+	// Analog comparator is not used, switch it off to save power.
+	ACSR = (1 << ACD);
 
 	// Setting up I/O ports.
 	DDRD = 0xFF;
@@ -505,11 +871,6 @@ void initSystem()
 	DDRC = 0xC0;
 	PORTC = 0x3F;
 		
-	// Initialize libraries and sub-systems.
-	updateVolumeControl(0);
-	
-	initLCD();
-	clearLCD();
-	
-	_delay_ms(20);
+	// Initialize libraries and sub-systems, volume is muted until the receiver is tuned.
+	initVolumeControl(0);
 }
@@ -37,52 +37,117 @@
 #define BUTTON_MEM_5		0x40
 #define BUTTON_MEM_6		0x80
 
-#define ROTARY_BUTTON		0x08
-
 #define MEM_GROUP_SIZE		6
 
+// Task periods in system ticks (1ms).
+#define ENCODER_TASK_MS		10
+#define SCAN_POLL_MS		1
+#define TUNER_TASK_MS		20
+#define RDS_TASK_MS			20
+#define VOLUME_TASK_MS		20
+#define UI_TASK_MS			20
+#define INPUT_TASK_MS		10
+#define TIMEOUT_TASK_MS		100
+#define STORAGE_TASK_MS		100
+
+// Worst-case latency per event source. Sampling runs in the tick ISR and never waits on a task, handling waits
+// for the task period plus the longest blocking task run, an AF probe (60ms STC wait + one 2ms TWI wait):
+//  - Buttons: 20ms debounce (4 samples of 5ms) + INPUT_TASK_MS + 62ms = ~92ms from the edge to the action.
+//  - Rotary encoder: steps are counted in the ISR and never lost, applied within ENCODER_TASK_MS + 62ms = ~72ms.
+//  - RDS: status is read every 20ms from the ISR, rdsTask drains the ring within RDS_TASK_MS + 62ms = ~82ms,
+//    well inside the ~350ms the 4 group capture ring holds, so groups are not lost to task delays.
+
+// Stereo indicator refresh interval of the manual tuner, in encoder task runs.
+#define INDICATOR_TASK_RUNS	25
+
+// Time to show the band scan result before returning to the tuner.
+#define SCAN_REPORT_MS		1500
+
+// Time to wait for the user to confirm the auto-store of the scan result, presets are kept on time-out.
+#define SCAN_CONFIRM_MS		10000
+
+// Tuner screen without any user action for this long enters the standby.
+#define STANDBY_IDLE_MINUTES	120
+#define TIMEOUT_TASK_RUNS_MIN	(60000 / TIMEOUT_TASK_MS)
+
+// Shared power-up wait of the LCD controller and the receiver.
+#define BOOT_POWER_UP_MS	((LCD_POWER_UP_MS > RECEIVER_POWER_UP_MS) ? LCD_POWER_UP_MS : RECEIVER_POWER_UP_MS)
+
 typedef enum
 {
 	TUNER_IDLE,
 	VOLUME_CONTROL,
-	TUNER_CONTROL
+	TUNER_CONTROL,
+	BAND_SCAN,
+	STANDBY
 } SYS_STATE;
 
 const unsigned char _memoryButtonGroup[] = {BUTTON_MEM_1, BUTTON_MEM_2, BUTTON_MEM_3, BUTTON_MEM_4, BUTTON_MEM_5, BUTTON_MEM_6};
-unsigned char _memoryHoldCounter[MEM_GROUP_SIZE];
 
-unsigned short _receiverInfo[6];
+unsigned short _receiverInfo[2];
 
 unsigned char _idleLimit;
 unsigned char _idleCounter;
 unsigned short _rotaryEncoderPos;
-unsigned char _lastEncoderVal;
-unsigned char _lastEncorderButtonVal;
-unsigned char _lastButtonState;
 unsigned char _memoryStoredFlag;
 unsigned char _defaultMemChannel;
 unsigned char _indicatorCounter;
+unsigned char _scanReportTimer;
+unsigned char _inactiveMinutes;
+unsigned short _inactiveTicks;
+unsigned short _wakeButtons;
+
+// Active duty cycle (1/1000) of the CPU, last measurement in each mode.
+unsigned short _activeDuty;
+unsigned short _standbyDuty;
+
+// Boot to audio (first tune complete) and boot to display (first tuner screen shown) times in system ticks.
+unsigned short _bootAudioTicks;
+unsigned short _bootDisplayTicks;
+unsigned char _nameChannel;
+unsigned short _namePI;
 
 BOOL _updateSystemConfig;
 BOOL _needUpdateUI;
 BOOL _clearRDSinfo;
+BOOL _startBandScan;
+BOOL _scanConfirm;
+BOOL _tuneSettled;
+BOOL _nameCached;
+BOOL _nameStored;
 
 char _lcdRow1 [LCD_MAX_ROW_LENGTH + 1];
 char _lcdRow2 [LCD_MAX_ROW_LENGTH + 1];
 
-char _stationName[MAX_STATION_NAME_SIZE];
-char _stationTempBuffer[MAX_STATION_NAME_SIZE];
+RDS_DATA _rdsData;
+RDS_GROUP _rdsGroup;
 
 SYS_STATE _currentState;
+SYS_STATE _lastState;
 SYS_CONFIG _currentConfig;
 MEM_ACTION _memAction;
+SEEK_ACTION _seekAction;
 
 void initSystem();
 void setConfigDefault(SYS_CONFIG *config);
-void initButtonScanner();
+void tunerTask();
+void rdsTask();
+void volumeTask();
+void encoderTask();
+void uiTask();
+void scanTask();
+void scanReportDone();
+void confirmAutoStore(BOOL store);
+void inputTask();
+void timeoutTask();
+void storageTask();
 
 void enterTunerControl();
 void enterVolumeControl();
+void enterBandScan();
+void showStationName(unsigned short channel);
 void exitSubSystem();
+void enterStandby();
+void exitStandby();
 
-#endif /* RDA5807_RADIO_MAIN_ */
\ No newline at end of file
+#endif /* RDA5807_RADIO_MAIN_ */
\ No newline at end of file
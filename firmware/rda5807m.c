@@ -22,16 +22,28 @@
 
 #include "global.h"
 
-#include <string.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include <stddef.h>
-#include <stdio.h>
 
 #include "iic.h"
 #include "rda5807m.h"
+#include "format.h"
 
+// Sequential access address (0x10) always starts at register 0x02 for writes and 0x0A for reads.
 #define RDA5807M_ADDRESS	0x20
 
+// Random access address (0x11) takes register index as the first byte.
+#define RDA5807M_RANDOM_ADDRESS	0x22
+
+// Status poll covers registers 0x0A and 0x0B.
+#define STATUS_DATA_LEN		4
+
+// RDS blocks A - D in registers 0x0C - 0x0F.
+#define RDS_BLOCK_DATA_LEN	8
+
+#define MAX_REGISTER_READ	6
+
 #define RECEIVER_CONFIG_LEN 12
 
 #define INIT_RX_REG_0	0xD0	// DHIZ | DMUTE | MONO | BASS | RCLK_MODE | RCLK | SEEKUP | SEEK
@@ -48,59 +60,389 @@
 #define INIT_RX_REG_11	0x02	// SEEK_TH_OLD | SEEK_TH_OLD | SEEK_TH_OLD | SEEK_TH_OLD | SEEK_TH_OLD | SEEK_TH_OLD | SOFTBLEND_EN | FREQ_MODE
 
 
+// Writable register 0x02 - 0x07 bit fields (H = high byte, L = low byte).
+#define REG02H_DMUTE		0x40
+#define REG02H_MONO			0x20
+#define REG02H_BASS			0x10
+#define REG02H_SEEKUP		0x02
+#define REG02H_SEEK			0x01
+#define REG02L_SKMODE		0x80
+#define REG02L_RDS_EN		0x08
+#define REG02L_SOFT_RESET	0x02
+#define REG02L_ENABLE		0x01
+#define REG03L_CHAN			0xC0
+#define REG03L_TUNE			0x10
+#define REG05H_SEEKTH		0x0F
+#define REG05L_VOLUME		0x0F
+
+// Byte offsets of the register fields in the shadow register file.
+#define RX_REG02H	0
+#define RX_REG02L	1
+#define RX_REG03H	2
+#define RX_REG03L	3
+#define RX_REG05H	6
+#define RX_REG05L	7
+
+#define RX_FIRST_REG		0x02
+#define RX_REG_COUNT		(RECEIVER_CONFIG_LEN / 2)
+#define RX_ALL_DIRTY		((1 << RX_REG_COUNT) - 1)
+
+// Shadow copy of writable registers 0x02 - 0x07 with per-register dirty bits.
 unsigned char receiverConfig[RECEIVER_CONFIG_LEN] = {INIT_RX_REG_0, INIT_RX_REG_1, INIT_RX_REG_2, INIT_RX_REG_3, INIT_RX_REG_4, INIT_RX_REG_5,
 													INIT_RX_REG_6, INIT_RX_REG_7, INIT_RX_REG_8, INIT_RX_REG_9, INIT_RX_REG_10, INIT_RX_REG_11};
-													
-void updateReceiverConfig(unsigned char updateLength)
+static unsigned char _receiverDirty = RX_ALL_DIRTY;
+
+static unsigned char _statusData[STATUS_DATA_LEN];
+static TWI_TRANSACTION _statusTrans;
+
+static void setReceiverBits(unsigned char pos, unsigned char mask, unsigned char value)
+{
+	unsigned char newValue = (receiverConfig[pos] & ~mask) | (value & mask);
+	
+	// Unchanged value does not generate any bus traffic.
+	if(newValue != receiverConfig[pos])
+	{
+		receiverConfig[pos] = newValue;
+		_receiverDirty |= (1 << (pos >> 1));
+	}
+}
+
+static BOOL writeReceiverRange(unsigned char firstReg, unsigned char lastReg)
 {
-	if(updateLength > RECEIVER_CONFIG_LEN)
+	unsigned char *data = &receiverConfig[firstReg * 2];
+	unsigned char dataLen = ((lastReg - firstReg) + 1) * 2;
+	
+	// Status read taken before the write describes the old tuning, it is finished and dropped.
+	if((_statusTrans.status == TWI_PENDING) || (_statusTrans.status == TWI_BUSY))
+	{
+		twiWait(&_statusTrans);
+	}
+	
+	_statusTrans.status = TWI_IDLE;
+	
+	// Sequential access always starts from register 0x02, otherwise register index costs one byte.
+	if(firstReg == 0)
 	{
-		updateLength = RECEIVER_CONFIG_LEN;
+		return (twiWriteReg(RDA5807M_ADDRESS, data, dataLen) == TWI_OK) ? TRUE : FALSE;
 	}
 	
-	twiWriteReg(RDA5807M_ADDRESS, receiverConfig, updateLength);
+	return (twiWriteRegAt(RDA5807M_RANDOM_ADDRESS, (firstReg + RX_FIRST_REG), data, dataLen) == TWI_OK) ? TRUE : FALSE;
+}
+
+BOOL commitReceiverConfig()
+{
+	unsigned char regPos, runStart, runEnd;
+	BOOL retState = TRUE;
+	
+	regPos = 0;
+	while(regPos < RX_REG_COUNT)
+	{
+		if(!(_receiverDirty & (1 << regPos)))
+		{
+			regPos++;
+			continue;
+		}
+		
+		// Collect dirty run, one clean register in between is cheaper to rewrite than a new transaction.
+		runStart = regPos;
+		runEnd = regPos;
+		for(regPos = (runStart + 1); regPos < RX_REG_COUNT; regPos++)
+		{
+			if(_receiverDirty & (1 << regPos))
+			{
+				runEnd = regPos;
+			}
+			else if((regPos - runEnd) > 1)
+			{
+				break;
+			}
+		}
+		
+		if(writeReceiverRange(runStart, runEnd) == TRUE)
+		{
+			_receiverDirty &= ~(((1 << (runEnd + 1)) - 1) & ~((1 << runStart) - 1));
+		}
+		else
+		{
+			retState = FALSE;
+		}
+		
+		regPos = runEnd + 1;
+	}
+	
+	// TUNE is cleared by the receiver once the tune is completed. SEEK stays set in the shadow until the seek
+	// ends (endReceiverSeek / stopReceiverSeek), other register 0x02 writes must not stop a running seek.
+	if(retState == TRUE)
+	{
+		receiverConfig[RX_REG03L] &= ~REG03L_TUNE;
+	}
+	
+	return retState;
+}
+
+void setReceiverEnable(BOOL enable)
+{
+	setReceiverBits(RX_REG02L, REG02L_ENABLE, (enable == TRUE) ? REG02L_ENABLE : 0x00);
+}
+
+void setReceiverSoftReset(BOOL reset)
+{
+	setReceiverBits(RX_REG02L, REG02L_SOFT_RESET, (reset == TRUE) ? REG02L_SOFT_RESET : 0x00);
+}
+
+void setReceiverMute(BOOL mute)
+{
+	// DMUTE is active low.
+	setReceiverBits(RX_REG02H, REG02H_DMUTE, (mute == TRUE) ? 0x00 : REG02H_DMUTE);
+}
+
+void setReceiverMono(BOOL mono)
+{
+	setReceiverBits(RX_REG02H, REG02H_MONO, (mono == TRUE) ? REG02H_MONO : 0x00);
+}
+
+void setReceiverBass(BOOL bass)
+{
+	setReceiverBits(RX_REG02H, REG02H_BASS, (bass == TRUE) ? REG02H_BASS : 0x00);
+}
+
+void setReceiverRDS(BOOL enable)
+{
+	setReceiverBits(RX_REG02L, REG02L_RDS_EN, (enable == TRUE) ? REG02L_RDS_EN : 0x00);
+}
+
+void setReceiverVolume(unsigned char volume)
+{
+	setReceiverBits(RX_REG05L, REG05L_VOLUME, volume);
+}
+
+void setReceiverSeekThreshold(unsigned char threshold)
+{
+	setReceiverBits(RX_REG05H, REG05H_SEEKTH, threshold);
+}
+
+void setReceiverChannel(unsigned short channel)
+{
+	setReceiverBits(RX_REG03H, 0xFF, (channel >> 2));
+	setReceiverBits(RX_REG03L, REG03L_CHAN, ((channel & 0x03) << 6));
+	
+	// Tuning is an action, always trigger it.
+	setReceiverBits(RX_REG03L, REG03L_TUNE, REG03L_TUNE);
 }
 
-void initReceiver()
+void setReceiverSeek(SEEK_MODE seekMode)
+{
+	setReceiverBits(RX_REG02H, REG02H_SEEKUP, (seekMode == SKMODE_UP) ? REG02H_SEEKUP : 0x00);
+	setReceiverBits(RX_REG02H, REG02H_SEEK, REG02H_SEEK);
+}
+
+void setReceiverSeekWrap(BOOL wrap)
+{
+	// SKMODE: 0 = wrap at the band limit, 1 = stop at the band limit.
+	setReceiverBits(RX_REG02L, REG02L_SKMODE, (wrap == TRUE) ? 0x00 : REG02L_SKMODE);
+}
+
+void endReceiverSeek()
+{
+	// Receiver clears SEEK by itself together with STC, only the shadow is updated.
+	receiverConfig[RX_REG02H] &= ~REG02H_SEEK;
+}
+
+void stopReceiverSeek()
+{
+	// Rewrite register 0x02 with SEEK cleared to stop the receiver.
+	receiverConfig[RX_REG02H] &= ~REG02H_SEEK;
+	_receiverDirty |= (1 << (RX_REG02H >> 1));
+	commitReceiverConfig();
+}
+
+void initReceiver(unsigned short channel)
 {
 	// Initialize receiver chip with default configuration.
-	updateReceiverConfig(RECEIVER_CONFIG_LEN);
-	_delay_ms(10);
+	_receiverDirty = RX_ALL_DIRTY;
+	commitReceiverConfig();
+	_delay_ms(RECEIVER_RESET_MS);
 	
-	// Release reset flag in configuration.
-	receiverConfig[1] = receiverConfig[1] & 0xFD;
-	updateReceiverConfig(2);
+	// Release reset flag and tune the start channel, both registers go out in one write.
+	setReceiverSoftReset(FALSE);
+	setReceiverChannel(channel);
+	commitReceiverConfig();
 }
 
 void updateChannel(unsigned short channel)
 {
-	receiverConfig[2] = channel >> 2;
-	receiverConfig[3] = (receiverConfig[3] & 0x0F) | ((channel & 0x03) << 6 ) | 0x10;
-	updateReceiverConfig(4);
+	setReceiverChannel(channel);
+	commitReceiverConfig();
 }
 
 void startSeek(SEEK_MODE seekMode)
 {
-	unsigned char skMode = (seekMode == SKMODE_UP) ? RDA5807_TUNE_UP : 0x00;
-	receiverConfig[0] = receiverConfig[0] & 0xFC;
-	receiverConfig[0] = receiverConfig[0] | skMode | RDA5807_START_TUNE;
-	updateReceiverConfig(3);
+	setReceiverSeek(seekMode);
+	commitReceiverConfig();
 }
 
-void readConfiguration(unsigned short *rxData)
+void powerDownReceiver()
 {
-	unsigned char regData[12];
+	setReceiverEnable(FALSE);
+	commitReceiverConfig();
+}
+
+void powerUpReceiver(unsigned short channel)
+{
+	// Register file is kept while the receiver is disabled, enable and tune without the soft reset of initReceiver.
+	setReceiverEnable(TRUE);
+	setReceiverChannel(channel);
+	commitReceiverConfig();
+}
+
+TUNE_STATS tuneStats;
+
+// Latest-wins tune requests, only the most recent target is kept.
+static unsigned short _tuneTarget;
+static unsigned short _tuneIssued;
+static unsigned char _tuneWait;
+static BOOL _tuneBusy;
+static BOOL _tuneRequested = FALSE;
+
+void requestTune(unsigned short channel)
+{
+	// First request of a tuning session is sent without waiting.
+	if(_tuneRequested == FALSE)
+	{
+		_tuneIssued = TUNE_NO_CHANNEL;
+		_tuneBusy = FALSE;
+	}
+	
+	_tuneTarget = channel;
+	_tuneRequested = TRUE;
+	tuneStats.requests++;
+}
+
+static void issueTune()
+{
+	updateChannel(_tuneTarget);
+	_tuneIssued = _tuneTarget;
+	_tuneWait = 0;
+	_tuneBusy = TRUE;
+	tuneStats.tunes++;
+}
+
+BOOL serviceTune()
+{
+	unsigned short status = 0;
+	
+	if((_tuneRequested == FALSE) || (_tuneTarget == _tuneIssued))
+	{
+		return FALSE;
+	}
+	
+	// Newer target waits for STC of the running tune, bounded by TUNE_MAX_WAIT_POLLS.
+	if(_tuneBusy == TRUE)
+	{
+		if((++_tuneWait) < TUNE_MAX_WAIT_POLLS)
+		{
+			readConfigurationFast(&status);
+			if((status & RDA5807_SEEK_TUNE_COMPLETE) == 0)
+			{
+				return TRUE;
+			}
+		}
+		else
+		{
+			tuneStats.forced++;
+		}
+	}
+	
+	issueTune();
+	return TRUE;
+}
+
+void flushTune()
+{
+	// Land on the final target without waiting, used when the tuner control is closed.
+	if((_tuneRequested == TRUE) && (_tuneTarget != _tuneIssued))
+	{
+		issueTune();
+	}
+	
+	_tuneRequested = FALSE;
+}
+
+volatile RDS_CAPTURE_STATS rdsCaptureStats;
+
+// RDS capture ring, written by the TWI callbacks and drained by the main loop.
+static RDS_GROUP _rdsCaptureBuffer[RDS_CAPTURE_SIZE];
+static volatile unsigned char _rdsCaptureHead;
+static volatile unsigned char _rdsCaptureTail;
+static volatile BOOL _rdsCaptureEnabled = FALSE;
+static unsigned char _rdsCaptureDivider;
+
+static unsigned char _rdsCaptureData[STATUS_DATA_LEN + RDS_BLOCK_DATA_LEN];
+static unsigned short _rdsLastBlocks[4];
+static TWI_TRANSACTION _rdsStatusTrans;
+static TWI_TRANSACTION _rdsBlockTrans;
+
+BOOL readReceiverRegisters(unsigned char reg, unsigned short *data, unsigned char count)
+{
+	unsigned char regData[MAX_REGISTER_READ * 2];
 	unsigned char regPos;
+	
+	if((data == NULL) || (count == 0) || (count > MAX_REGISTER_READ))
+	{
+		return FALSE;
+	}
+	
+	if(twiReadRegAt(RDA5807M_RANDOM_ADDRESS, reg, regData, (count * 2)) != TWI_OK)
+	{
+		return FALSE;
+	}
+	
+	// Convert received 8-bit data into 16-bit data chunks.
+	for(regPos = 0; regPos < count; regPos++)
+	{
+		data[regPos] = ((regData[regPos * 2] << 8) | regData[(regPos * 2) + 1]);
+	}
+	
+	return TRUE;
+}
+
+BOOL requestConfiguration()
+{
+	// Status read is already in flight.
+	if((_statusTrans.status == TWI_PENDING) || (_statusTrans.status == TWI_BUSY))
+	{
+		return TRUE;
+	}
+	
+	// Sequential read of status registers 0x0A and 0x0B only.
+	_statusTrans.addr = RDA5807M_ADDRESS;
+	_statusTrans.direction = TWI_READ;
+	_statusTrans.flags = 0;
+	_statusTrans.buffer = _statusData;
+	_statusTrans.length = STATUS_DATA_LEN;
+	_statusTrans.callback = NULL;
+	
+	return twiQueue(&_statusTrans, TWI_LANE_NORMAL);
+}
 
+void readConfiguration(unsigned short *rxData)
+{
 	if(rxData != NULL)
 	{
-		twiReadReg(RDA5807M_ADDRESS, regData, 12);
+		// Use the read completed since requestConfiguration, wait for the one in flight or start a new one.
+		if((_statusTrans.status != TWI_DONE) && (requestConfiguration() == TRUE))
+		{
+			twiWait(&_statusTrans);
+		}
 		
-		// Convert received 8-bit data into 16-bit data chunks.
-		for(regPos = 0; regPos < 6; regPos++)
+		if(_statusTrans.status != TWI_DONE)
 		{
-			rxData[regPos] = ((regData[regPos * 2] << 8) | regData [(regPos * 2) + 1] );
+			return;
 		}
+		
+		_statusTrans.status = TWI_IDLE;
+		rxData[0] = ((_statusData[0] << 8) | _statusData[1]);
+		rxData[1] = ((_statusData[2] << 8) | _statusData[3]);
 	}
 }
 
@@ -110,76 +452,156 @@ void readConfigurationFast(unsigned short *rxData)
 	
 	if(rxData != NULL)
 	{
-		twiReadReg(RDA5807M_ADDRESS, regData, 2);	
-		rxData[0] = ((regData[0] << 8) | regData [1] );	
+		if(twiReadReg(RDA5807M_ADDRESS, regData, 2) == TWI_OK)
+		{
+			rxData[0] = ((regData[0] << 8) | regData [1] );
+		}
 	}
 }
 
 void extractFrequency(unsigned short freqBlock, char *freqStr)
 {
-	float retData = (((freqBlock & 0x03FF) * 100) + 87000);
-	sprintf(freqStr, "%.2f MHz  ", (retData/1000));
+	formatFrequency((freqBlock & RDA5807_CHANNEL_INFO), freqStr);
 }
 
-void clearRDSData(char *stationTempBuffer, char *StationName, unsigned char bufferSize)
+static void rdsBlocksReady(TWI_TRANSACTION *trans)
 {
-	memset(stationTempBuffer, 0, bufferSize);
-	memset(StationName, 0, bufferSize);
+	RDS_GROUP *group;
+	unsigned char blockPos;
+	unsigned short blockData;
+	BOOL duplicate = TRUE;
+	
+	if((trans->status != TWI_DONE) || (_rdsCaptureEnabled == FALSE))
+	{
+		return;
+	}
+	
+	// RDSR stays set for the whole group period, the same group is sampled more than once.
+	for(blockPos = 0; blockPos < 4; blockPos++)
+	{
+		blockData = ((_rdsCaptureData[STATUS_DATA_LEN + (blockPos * 2)] << 8) | _rdsCaptureData[STATUS_DATA_LEN + (blockPos * 2) + 1]);
+		if(blockData != _rdsLastBlocks[blockPos])
+		{
+			_rdsLastBlocks[blockPos] = blockData;
+			duplicate = FALSE;
+		}
+	}
+	
+	if(duplicate == TRUE)
+	{
+		rdsCaptureStats.duplicates++;
+		return;
+	}
+	
+	if(((unsigned char)(_rdsCaptureHead - _rdsCaptureTail)) >= RDS_CAPTURE_SIZE)
+	{
+		rdsCaptureStats.overflows++;
+		return;
+	}
+	
+	// RDS blocks A - D with block error levels of register 0x0B.
+	group = &_rdsCaptureBuffer[_rdsCaptureHead & (RDS_CAPTURE_SIZE - 1)];
+	for(blockPos = 0; blockPos < 4; blockPos++)
+	{
+		group->blocks[blockPos] = _rdsLastBlocks[blockPos];
+	}
+	
+	group->errors = _rdsCaptureData[3] & RDA5807_BLOCK_ERRORS;
+	
+	_rdsCaptureHead++;
+	rdsCaptureStats.groups++;
+}
+
+static void rdsStatusReady(TWI_TRANSACTION *trans)
+{
+	if((trans->status != TWI_DONE) || (!(_rdsCaptureData[0] & (RDA5807_HAS_RDS_INFO >> 8))))
+	{
+		return;
+	}
+	
+	// New group is ready, fetch blocks 0x0C - 0x0F right behind the status bytes.
+	_rdsBlockTrans.addr = RDA5807M_RANDOM_ADDRESS;
+	_rdsBlockTrans.direction = TWI_READ;
+	_rdsBlockTrans.flags = TWI_FLAG_REG_INDEX;
+	_rdsBlockTrans.regIndex = RDA5807_REG_RDS_A;
+	_rdsBlockTrans.buffer = &_rdsCaptureData[STATUS_DATA_LEN];
+	_rdsBlockTrans.length = RDS_BLOCK_DATA_LEN;
+	_rdsBlockTrans.callback = rdsBlocksReady;
+	
+	twiQueue(&_rdsBlockTrans, TWI_LANE_NORMAL);
+}
+
+void captureRDSGroup()
+{
+	if(_rdsCaptureEnabled == FALSE)
+	{
+		return;
+	}
+	
+	// Previous sample is still on the bus.
+	if((_rdsStatusTrans.status == TWI_PENDING) || (_rdsStatusTrans.status == TWI_BUSY) || 
+		(_rdsBlockTrans.status == TWI_PENDING) || (_rdsBlockTrans.status == TWI_BUSY))
+	{
+		rdsCaptureStats.skipped++;
+		return;
+	}
+	
+	_rdsStatusTrans.addr = RDA5807M_ADDRESS;
+	_rdsStatusTrans.direction = TWI_READ;
+	_rdsStatusTrans.flags = 0;
+	_rdsStatusTrans.buffer = _rdsCaptureData;
+	_rdsStatusTrans.length = STATUS_DATA_LEN;
+	_rdsStatusTrans.callback = rdsStatusReady;
+	
+	if(twiQueue(&_rdsStatusTrans, TWI_LANE_NORMAL) != TRUE)
+	{
+		rdsCaptureStats.skipped++;
+	}
 }
 
-BOOL extractRDSData(unsigned short *rxData, char *stationTempBuffer, char *StationName)
+void rdsCaptureTick()
 {
-	unsigned short rdsB, rdsD;
-	unsigned char offset, char1, char2;
-	BOOL hasStationInfo = FALSE;
+	// Called from the tick interrupt, the cadence does not depend on the tasks of the main loop.
+	if((++_rdsCaptureDivider) < RDS_CAPTURE_TICKS)
+	{
+		return;
+	}
 	
-	if((rxData[0] & RDA5807_HAS_RDS_INFO))
+	_rdsCaptureDivider = 0;
+	captureRDSGroup();
+}
+
+void enableRDSCapture(BOOL enable)
+{
+	_rdsCaptureEnabled = enable;
+	flushRDSGroups();
+}
+
+void flushRDSGroups()
+{
+	unsigned char blockPos;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		// Extract RDS data blocks which need to display station name.
-		rdsB = rxData[3];
-		rdsD = rxData[5];
+		_rdsCaptureTail = _rdsCaptureHead;
 		
-		switch(rdsB & RDS_GROUP)
+		for(blockPos = 0; blockPos < 4; blockPos++)
 		{
-			case RDS_GROUP_A0:
-			case RDS_GROUP_B0:
-				// Station information extraction routine.
-				
-				hasStationInfo = TRUE;
-				
-				offset = (rdsB & 0x03) << 1;
-				char1 = (char)(rdsD >> 8);
-				char2 = (char)(rdsD & 0xFF);
-				
-				// Check for valid array limits.
-				if(offset >= MAX_STATION_NAME_SIZE)
-				{
-					return FALSE;	
-				}
-				
-				// Verify the 1st bit with last received character.
-				if (stationTempBuffer[offset] == char1) 
-				{
-					StationName[offset] = char1;
-				} 
-				else if((char1 >= 0x20) && (char1 <= 0x7D))
-				{
-					stationTempBuffer[offset] = char1;
-				}
-
-				// Verify the 2nd bit with last received character.
-				if (stationTempBuffer[offset + 1] == char2) 
-				{
-					StationName[offset + 1] = char2;
-				} 
-				else if((char2 >= 0x20) && (char2 <= 0x7D))
-				{
-					stationTempBuffer[offset + 1] = char2;
-				}
-				
-				break;
+			_rdsLastBlocks[blockPos] = 0;
 		}
 	}
+}
 
-	return hasStationInfo;
-}
\ No newline at end of file
+BOOL readRDSGroup(RDS_GROUP *group)
+{
+	if(_rdsCaptureTail == _rdsCaptureHead)
+	{
+		return FALSE;
+	}
+	
+	*group = _rdsCaptureBuffer[_rdsCaptureTail & (RDS_CAPTURE_SIZE - 1)];
+	
+	// Slot is released only after the copy is completed.
+	_rdsCaptureTail++;
+	return TRUE;
+}
@@ -23,19 +23,39 @@
 #ifndef RDA5807M_H_
 #define RDA5807M_H_
 
+#include "rds.h"
+
+#define RDA5807_REG_STATUS			0x0A
+#define RDA5807_REG_RSSI			0x0B
+#define RDA5807_REG_RDS_A			0x0C
+#define RDA5807_REG_RDS_D			0x0F
+
 #define RDA5807_SEEK_TUNE_COMPLETE	0x4000
+#define RDA5807_SEEK_FAIL			0x2000
 #define RDA5807_HAS_RDS_INFO		0x8000
 #define RDA5807_CHANNEL_INFO		0x03FF
 #define RDA5807_STEREO				0x0400
 
-#define RDA5807_START_TUNE			0x01
-#define RDA5807_TUNE_UP				0x02
+#define RDA5807_RSSI_SHIFT			9
+#define RDA5807_FM_TRUE				0x0100
+#define RDA5807_FM_READY			0x0080
+
+
+#define RDA5807_BLOCK_ERRORS		0x000F
 
-#define RDS_GROUP			0xF800
-#define RDS_GROUP_A0		0x0000
-#define RDS_GROUP_B0		0x0800
+// Number of raw RDS groups held in the capture ring (power of 2).
+#define RDS_CAPTURE_SIZE			4
 
-#define MAX_STATION_NAME_SIZE	10
+// RDS status is sampled from the system tick every RDS_CAPTURE_TICKS (1ms) ticks, ~4 samples per group (87.6ms).
+#define RDS_CAPTURE_TICKS			20
+
+// Number of serviceTune calls to wait for STC before the latest target is tuned anyway.
+#define TUNE_MAX_WAIT_POLLS			5
+#define TUNE_NO_CHANNEL				0xFFFF
+
+// Receiver power-up time before the first register write, and soft reset pulse width.
+#define RECEIVER_POWER_UP_MS		20
+#define RECEIVER_RESET_MS			10
 
 typedef enum
 {
@@ -43,16 +63,60 @@ typedef enum
 	SKMODE_UP
 } SEEK_MODE;
 
-void updateReceiverConfig(unsigned char updateLength);													
-void initReceiver();
+typedef struct
+{
+	unsigned short groups;
+	unsigned short duplicates;
+	unsigned short overflows;
+	unsigned short skipped;
+} RDS_CAPTURE_STATS;
+
+extern volatile RDS_CAPTURE_STATS rdsCaptureStats;
+
+typedef struct
+{
+	unsigned short requests;
+	unsigned short tunes;			// Tune commands sent to the receiver.
+	unsigned short forced;			// Tunes sent before STC of the previous tune.
+} TUNE_STATS;
+
+extern TUNE_STATS tuneStats;
+
+BOOL commitReceiverConfig();
+void setReceiverEnable(BOOL enable);
+void setReceiverSoftReset(BOOL reset);
+void setReceiverMute(BOOL mute);
+void setReceiverMono(BOOL mono);
+void setReceiverBass(BOOL bass);
+void setReceiverRDS(BOOL enable);
+void setReceiverVolume(unsigned char volume);
+void setReceiverSeekThreshold(unsigned char threshold);
+void setReceiverChannel(unsigned short channel);
+void setReceiverSeek(SEEK_MODE seekMode);
+void setReceiverSeekWrap(BOOL wrap);
+void endReceiverSeek();
+void stopReceiverSeek();
+
+void initReceiver(unsigned short channel);
+BOOL readReceiverRegisters(unsigned char reg, unsigned short *data, unsigned char count);
+BOOL requestConfiguration();
 void readConfiguration(unsigned short *rxData);
 void readConfigurationFast(unsigned short *rxData);
 
 void updateChannel(unsigned short channel);
 void startSeek(SEEK_MODE seekMode);
+void powerDownReceiver();
+void powerUpReceiver(unsigned short channel);
+
+void requestTune(unsigned short channel);
+BOOL serviceTune();
+void flushTune();
 
 void extractFrequency(unsigned short freqBlock, char *freqStr);
-BOOL extractRDSData(unsigned short *rxData, char *stationTempBuffer, char *StationName);
-void clearRDSData(char *stationTempBuffer, char *StationName, unsigned char bufferSize);
+void captureRDSGroup();
+void rdsCaptureTick();
+void enableRDSCapture(BOOL enable);
+void flushRDSGroups();
+BOOL readRDSGroup(RDS_GROUP *group);
 
-#endif /* RDA5807M_H_ */
\ No newline at end of file
+#endif /* RDA5807M_H_ */
\ No newline at end of file
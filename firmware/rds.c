@@ -0,0 +1,365 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+
+#include "global.h"
+
+#include <string.h>
+
+#include "rds.h"
+
+#define RDS_GROUP_TYPE(b)		((b) >> 12)
+#define RDS_GROUP_VERSION_B		0x0800
+#define RDS_TP					0x0400
+#define RDS_TA					0x0010
+#define RDS_RT_AB				0x0010
+
+#define RDS_RT_SEGMENTS			16
+#define RDS_RT_END				0x0D
+
+// AF codes 1 - 204 are 87.6 - 107.9MHz, 224 - 249 announce the number of AFs in the list, 250 marks an LF/MF code.
+#define RDS_AF_FIRST			1
+#define RDS_AF_LAST				204
+#define RDS_AF_COUNT_BASE		224
+#define RDS_AF_COUNT_LAST		249
+#define RDS_AF_LFMF_FOLLOWS		250
+#define RDS_AF_CHANNEL_OFFSET	5
+
+static BOOL isPrintable(char data)
+{
+	return ((data >= 0x20) && (data <= 0x7D)) ? TRUE : FALSE;
+}
+
+static unsigned char getGroupErrorLevel(RDS_GROUP *group)
+{
+	unsigned char blerA = (group->errors >> 2) & 0x03;
+	unsigned char blerB = group->errors & 0x03;
+	
+	// Receiver reports only blocks A and B, the worse one qualifies the whole group.
+	return (blerA > blerB) ? blerA : blerB;
+}
+
+static unsigned char decodePS(RDS_DATA *rds, unsigned short blockB, unsigned short blockD, unsigned char errorLevel)
+{
+	unsigned char offset = (blockB & 0x03) << 1;
+	unsigned char charPos, pos, votes;
+	unsigned char updated = RDS_FIELD_PS;
+	char charData;
+	BOOL segmentReady = TRUE;
+	
+	// Error-free segments are accepted at once, corrected segments need more sightings.
+	if(errorLevel == RDS_BLER_NONE)
+	{
+		votes = RDS_PS_VOTES_NONE;
+	}
+	else if(errorLevel == RDS_BLER_LOW)
+	{
+		votes = RDS_PS_VOTES_LOW;
+	}
+	else
+	{
+		votes = RDS_PS_VOTES_HIGH;
+	}
+	
+	for(charPos = 0; charPos < 2; charPos++)
+	{
+		pos = offset + charPos;
+		charData = (char)((charPos == 0) ? (blockD >> 8) : (blockD & 0xFF));
+		
+		if(rds->psCandidate[pos] == charData)
+		{
+			rds->psVotes[pos] = ((rds->psVotes[pos] + votes) > RDS_PS_MAX_VOTES) ? RDS_PS_MAX_VOTES : (rds->psVotes[pos] + votes);
+		}
+		else if(rds->psVotes[pos] > votes)
+		{
+			// Conflicting character weakens the current candidate.
+			rds->psVotes[pos] -= votes;
+		}
+		else if(isPrintable(charData) == TRUE)
+		{
+			rds->psCandidate[pos] = charData;
+			rds->psVotes[pos] = votes;
+		}
+		else
+		{
+			rds->psVotes[pos] = 0;
+		}
+		
+		if(rds->psVotes[pos] >= RDS_PS_ACCEPT_VOTES)
+		{
+			// Any change of an accepted character restarts the stability check.
+			if(rds->ps[pos] != rds->psCandidate[pos])
+			{
+				rds->ps[pos] = rds->psCandidate[pos];
+				rds->valid &= ~RDS_FIELD_PS_STABLE;
+			}
+		}
+		else
+		{
+			segmentReady = FALSE;
+		}
+	}
+	
+	if(segmentReady == TRUE)
+	{
+		rds->psSegments |= (1 << (blockB & 0x03));
+	}
+	
+	if((rds->psSegments == 0x0F) && (!(rds->valid & RDS_FIELD_PS)))
+	{
+		rds->valid |= RDS_FIELD_PS;
+		rds->psValidGroup = rds->groupCount;
+	}
+	
+	// PS is stable once every character is confirmed beyond the accept level.
+	if((rds->valid & (RDS_FIELD_PS | RDS_FIELD_PS_STABLE)) == RDS_FIELD_PS)
+	{
+		for(pos = 0; pos < RDS_PS_LENGTH; pos++)
+		{
+			if(rds->psVotes[pos] < RDS_PS_STABLE_VOTES)
+			{
+				break;
+			}
+		}
+		
+		if(pos == RDS_PS_LENGTH)
+		{
+			rds->valid |= RDS_FIELD_PS_STABLE;
+			updated |= RDS_FIELD_PS_STABLE;
+		}
+	}
+	
+	return updated;
+}
+
+static unsigned char decodeAF(RDS_DATA *rds, unsigned short blockC)
+{
+	unsigned char codePos, code, afPos;
+	
+	for(codePos = 0; codePos < 2; codePos++)
+	{
+		code = (codePos == 0) ? (blockC >> 8) : (blockC & 0xFF);
+		
+		if(code == RDS_AF_LFMF_FOLLOWS)
+		{
+			// Pair carries an LF/MF frequency, the next code is not an FM channel.
+			codePos++;
+		}
+		else if((code >= RDS_AF_COUNT_BASE) && (code <= RDS_AF_COUNT_LAST))
+		{
+			// Different length announcement means a new AF list.
+			if((code - RDS_AF_COUNT_BASE) != rds->afExpected)
+			{
+				rds->afExpected = code - RDS_AF_COUNT_BASE;
+				rds->afCount = 0;
+				rds->valid &= ~RDS_FIELD_AF;
+			}
+		}
+		else if((code >= RDS_AF_FIRST) && (code <= RDS_AF_LAST) && (rds->afCount < RDS_AF_MAX))
+		{
+			code += RDS_AF_CHANNEL_OFFSET;
+			
+			for(afPos = 0; afPos < rds->afCount; afPos++)
+			{
+				if(rds->af[afPos] == code)
+				{
+					break;
+				}
+			}
+			
+			if(afPos == rds->afCount)
+			{
+				rds->af[rds->afCount++] = code;
+			}
+		}
+	}
+	
+	// List is complete once all announced (or as many as fit) frequencies are received.
+	if((rds->afExpected > 0) && ((rds->afCount >= rds->afExpected) || (rds->afCount == RDS_AF_MAX)))
+	{
+		rds->valid |= RDS_FIELD_AF;
+		return RDS_FIELD_AF;
+	}
+	
+	return 0;
+}
+
+static unsigned char decodeRT(RDS_DATA *rds, unsigned short *blocks, BOOL versionB)
+{
+	unsigned char segment = blocks[1] & 0x0F;
+	unsigned char charCount = (versionB == TRUE) ? 2 : 4;
+	unsigned char offset = segment * charCount;
+	unsigned char charPos, segmentCount;
+	unsigned short segmentMask;
+	char charData[4];
+	char newChar;
+	
+	// A/B flag toggle or message type change means new radio text.
+	if(((blocks[1] & RDS_RT_AB) != rds->rtFlag) || (versionB != rds->rtShort))
+	{
+		memset(rds->rt, 0, sizeof(rds->rt));
+		rds->rtFlag = blocks[1] & RDS_RT_AB;
+		rds->rtShort = versionB;
+		rds->rtSegments = 0;
+		rds->rtLength = RDS_RT_LENGTH;
+		rds->valid &= ~RDS_FIELD_RT;
+	}
+	
+	charData[0] = (char)(blocks[2] >> 8);
+	charData[1] = (char)(blocks[2] & 0xFF);
+	charData[2] = (char)(blocks[3] >> 8);
+	charData[3] = (char)(blocks[3] & 0xFF);
+	
+	for(charPos = 0; charPos < charCount; charPos++)
+	{
+		// Version B carries only two characters in block D.
+		newChar = charData[(versionB == TRUE) ? (charPos + 2) : charPos];
+		
+		// Characters beyond the kept length are dropped, their segments still count as received.
+		if((offset + charPos) >= RDS_RT_LENGTH)
+		{
+			break;
+		}
+		
+		if(newChar == RDS_RT_END)
+		{
+			rds->rtLength = offset + charPos;
+			break;
+		}
+		
+		rds->rt[offset + charPos] = newChar;
+	}
+	
+	rds->rtSegments |= (1 << segment);
+	
+	// Text is complete when all segments up to the end marker are received.
+	segmentCount = (rds->rtLength + (charCount - 1)) / charCount;
+	segmentMask = (segmentCount >= RDS_RT_SEGMENTS) ? 0xFFFF : ((1 << segmentCount) - 1);
+	if((rds->rtSegments & segmentMask) == segmentMask)
+	{
+		rds->rt[rds->rtLength] = 0;
+		rds->valid |= RDS_FIELD_RT;
+	}
+	
+	return RDS_FIELD_RT;
+}
+
+static unsigned char decodeClock(RDS_DATA *rds, unsigned short *blocks)
+{
+	RDS_CLOCK clock;
+	
+	clock.mjd = (((unsigned long)(blocks[1] & 0x03)) << 15) | (blocks[2] >> 1);
+	clock.hour = ((blocks[2] & 0x01) << 4) | (blocks[3] >> 12);
+	clock.minute = (blocks[3] >> 6) & 0x3F;
+	clock.offset = blocks[3] & 0x1F;
+	
+	if(blocks[3] & 0x20)
+	{
+		clock.offset = -clock.offset;
+	}
+	
+	// Reject out of range clock-time messages, the last valid time is kept.
+	if((clock.hour > 23) || (clock.minute > 59))
+	{
+		return 0;
+	}
+	
+	rds->clock = clock;
+	rds->valid |= RDS_FIELD_CT;
+	return RDS_FIELD_CT;
+}
+
+void resetRDSData(RDS_DATA *rds)
+{
+	memset(rds, 0, sizeof(RDS_DATA));
+	rds->rtLength = RDS_RT_LENGTH;
+}
+
+unsigned char decodeRDSGroup(RDS_DATA *rds, RDS_GROUP *group)
+{
+	unsigned short *blocks = group->blocks;
+	unsigned char updated = 0;
+	unsigned char errorLevel = getGroupErrorLevel(group);
+	BOOL versionB = (blocks[1] & RDS_GROUP_VERSION_B) ? TRUE : FALSE;
+	
+	// Every received group is counted to measure the acquisition time.
+	rds->groupCount++;
+	
+	// Block B is mandatory to identify the group.
+	if((group->errors & 0x03) == RDS_BLER_FAIL)
+	{
+		return 0;
+	}
+	
+	// Program identification, accepted after two identical codes.
+	if(((group->errors >> 2) & 0x03) != RDS_BLER_FAIL)
+	{
+		if(blocks[0] == rds->piCandidate)
+		{
+			rds->pi = blocks[0];
+			rds->valid |= RDS_FIELD_PI;
+			updated |= RDS_FIELD_PI;
+		}
+		
+		rds->piCandidate = blocks[0];
+	}
+	
+	// Program type and traffic program flags are carried in every group.
+	rds->pty = (blocks[1] >> 5) & 0x1F;
+	rds->tp = (blocks[1] & RDS_TP) ? TRUE : FALSE;
+	rds->valid |= RDS_FIELD_PTY;
+	updated |= RDS_FIELD_PTY;
+	
+	switch(RDS_GROUP_TYPE(blocks[1]))
+	{
+		case 0:
+			// Basic tuning and switching information (0A / 0B).
+			rds->ta = (blocks[1] & RDS_TA) ? TRUE : FALSE;
+			updated |= decodePS(rds, blocks[1], blocks[3], errorLevel);
+			
+			// Block C of version A carries the alternative frequencies.
+			if((versionB == FALSE) && (errorLevel <= RDS_BLER_PAYLOAD_MAX))
+			{
+				updated |= decodeAF(rds, blocks[2]);
+			}
+			break;
+			
+		case 2:
+			// Radio text (2A / 2B).
+			if(errorLevel <= RDS_BLER_PAYLOAD_MAX)
+			{
+				updated |= decodeRT(rds, blocks, versionB);
+			}
+			break;
+			
+		case 4:
+			// Clock-time and date (4A only), a wrong time would stay on for a minute so only clean groups are used.
+			if((versionB == FALSE) && (errorLevel <= RDS_BLER_CLOCK_MAX))
+			{
+				updated |= decodeClock(rds, blocks);
+			}
+			break;
+	}
+	
+	// Report only the completed fields which are touched by this group.
+	return (updated & rds->valid);
+}
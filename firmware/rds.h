@@ -0,0 +1,114 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef RDS_H_
+#define RDS_H_
+
+#include "global.h"
+
+#define RDS_PS_LENGTH		8
+#define RDS_AF_MAX			8
+
+// RadioText is kept up to two rows of the display: all of a 2B text, the first 32 of the 64 characters of 2A.
+#define RDS_RT_LENGTH		32
+
+// Field validity / update flags.
+#define RDS_FIELD_PI		0x01
+#define RDS_FIELD_PTY		0x02
+#define RDS_FIELD_PS		0x04
+#define RDS_FIELD_RT		0x08
+#define RDS_FIELD_CT		0x10
+#define RDS_FIELD_PS_STABLE	0x20
+#define RDS_FIELD_AF		0x40
+
+// PS character votes by block error level, character is accepted at RDS_PS_ACCEPT_VOTES.
+#define RDS_PS_VOTES_NONE	4
+#define RDS_PS_VOTES_LOW	2
+#define RDS_PS_VOTES_HIGH	1
+#define RDS_PS_ACCEPT_VOTES	4
+#define RDS_PS_STABLE_VOTES	8
+#define RDS_PS_MAX_VOTES	16
+
+// Block error levels reported by the receiver (BLERA / BLERB).
+#define RDS_BLER_NONE		0x00
+#define RDS_BLER_LOW		0x01
+#define RDS_BLER_HIGH		0x02
+#define RDS_BLER_FAIL		0x03
+
+// Receiver has no error flags for blocks C and D, their payload is taken only from groups this clean.
+#define RDS_BLER_PAYLOAD_MAX	RDS_BLER_LOW
+#define RDS_BLER_CLOCK_MAX		RDS_BLER_NONE
+
+typedef struct
+{
+	unsigned short blocks[4];
+	unsigned char errors;			// BLERA (bits 3:2) and BLERB (bits 1:0) from register 0x0B.
+} RDS_GROUP;
+
+typedef struct
+{
+	unsigned long mjd;
+	unsigned char hour;
+	unsigned char minute;
+	signed char offset;				// Local time offset in half hours.
+} RDS_CLOCK;
+
+typedef struct
+{
+	unsigned short pi;
+	unsigned char pty;
+	BOOL tp;
+	BOOL ta;
+	
+	char ps[RDS_PS_LENGTH + 1];
+	char rt[RDS_RT_LENGTH + 1];
+	RDS_CLOCK clock;
+	
+	// Alternative frequencies as receiver channels (method A list).
+	unsigned char af[RDS_AF_MAX];
+	unsigned char afCount;
+	unsigned char afExpected;
+	
+	// Segment validity bitmaps of the multi-group fields.
+	unsigned char psSegments;
+	unsigned short rtSegments;
+	
+	// Completed fields.
+	unsigned char valid;
+	
+	// Number of decoded groups since reset, and the group count at which PS got valid.
+	unsigned short groupCount;
+	unsigned short psValidGroup;
+	
+	// Decoder state.
+	unsigned short piCandidate;
+	char psCandidate[RDS_PS_LENGTH];
+	unsigned char psVotes[RDS_PS_LENGTH];
+	unsigned char rtFlag;
+	unsigned char rtLength;
+	BOOL rtShort;
+} RDS_DATA;
+
+void resetRDSData(RDS_DATA *rds);
+unsigned char decodeRDSGroup(RDS_DATA *rds, RDS_GROUP *group);
+
+#endif /* RDS_H_ */
@@ -0,0 +1,382 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+
+#include "global.h"
+
+#include <stddef.h>
+
+#include "storage.h"
+#include "sched.h"
+#include "scan.h"
+
+typedef enum
+{
+	SEEK_IDLE,
+	SEEK_RUNNING,
+	SEEK_WRAPPING
+} SEEK_STATE;
+
+SCAN_RESULT scanResult;
+SEEK_STATS seekStats;
+
+static volatile BOOL _scanRunning = FALSE;
+static unsigned char _scanChannel;
+static unsigned char _scanWait;
+static unsigned char _scanRetry;
+static unsigned short _scanStcAverage = (SCAN_STEP_TIMEOUT_MAX / 2) << 3;		// Running average of the STC time, x8.
+static unsigned short _scanRestoreChannel;
+static unsigned short _scanStartTick;
+static SCAN_STATION _scanLastStation;
+
+static volatile SEEK_STATE _seekState = SEEK_IDLE;
+static SEEK_MODE _seekMode;
+static unsigned short _seekStartChannel;
+static unsigned char _seekSettle;
+static BOOL _seekWrap;
+static BOOL _seekWrapped;
+
+static void removeStation(unsigned char channel)
+{
+	unsigned char pos;
+	BOOL found = FALSE;
+	
+	for(pos = 0; pos < scanResult.count; pos++)
+	{
+		if(scanResult.stations[pos].channel == channel)
+		{
+			found = TRUE;
+		}
+		
+		if((found == TRUE) && ((pos + 1) < scanResult.count))
+		{
+			scanResult.stations[pos] = scanResult.stations[pos + 1];
+		}
+	}
+	
+	if(found == TRUE)
+	{
+		scanResult.count--;
+	}
+}
+
+static void addStation(unsigned char channel, unsigned char rssi)
+{
+	unsigned char pos;
+	
+	// Strong transmitter leaks into the next channel, keep only the stronger one of the pair.
+	if((_scanLastStation.rssi != 0) && (channel == (_scanLastStation.channel + 1)))
+	{
+		if(rssi <= _scanLastStation.rssi)
+		{
+			return;
+		}
+		
+		removeStation(_scanLastStation.channel);
+	}
+	
+	_scanLastStation.channel = channel;
+	_scanLastStation.rssi = rssi;
+	
+	// Table is full and the new station is the weakest one.
+	if((scanResult.count == SCAN_TABLE_SIZE) && (rssi <= scanResult.stations[SCAN_TABLE_SIZE - 1].rssi))
+	{
+		return;
+	}
+	
+	// Insert into the RSSI ordered table, weakest station drops out when the table is full.
+	pos = (scanResult.count < SCAN_TABLE_SIZE) ? scanResult.count++ : (SCAN_TABLE_SIZE - 1);
+	while((pos > 0) && (scanResult.stations[pos - 1].rssi < rssi))
+	{
+		scanResult.stations[pos] = scanResult.stations[pos - 1];
+		pos--;
+	}
+	
+	scanResult.stations[pos].channel = channel;
+	scanResult.stations[pos].rssi = rssi;
+}
+
+unsigned char getStcTimeout()
+{
+	unsigned char timeout = _scanStcAverage >> 2;
+	
+	if(timeout < SCAN_STEP_TIMEOUT_MIN)
+	{
+		return SCAN_STEP_TIMEOUT_MIN;
+	}
+	
+	return (timeout > SCAN_STEP_TIMEOUT_MAX) ? SCAN_STEP_TIMEOUT_MAX : timeout;
+}
+
+void addStcTime(unsigned char ticks)
+{
+	_scanStcAverage = (_scanStcAverage - (_scanStcAverage >> 3)) + ticks;
+}
+
+void startBandScan(unsigned short restoreChannel)
+{
+	scanResult.count = 0;
+	scanResult.timeouts = 0;
+	scanResult.retries = 0;
+	scanResult.elapsedTicks = 0;
+	_scanStartTick = getSystemTicks();
+	
+	_scanLastStation.channel = 0;
+	_scanLastStation.rssi = 0;
+	_scanRestoreChannel = restoreChannel;
+	_scanChannel = SCAN_FIRST_CHANNEL;
+	_scanWait = 0;
+	_scanRetry = 0;
+	
+	// Keep audio muted while the receiver steps through the band.
+	setReceiverMute(TRUE);
+	updateChannel(_scanChannel);
+	
+	_scanRunning = TRUE;
+}
+
+BOOL serviceBandScan()
+{
+	unsigned short rxData[2];
+	unsigned char channel, rssi;
+	BOOL stationFound;
+	
+	if(_scanRunning == FALSE)
+	{
+		return FALSE;
+	}
+	
+	rxData[0] = 0;
+	rxData[1] = 0;
+	readConfiguration(rxData);
+	
+	// Wait for STC of the current channel, bounded by the step timeout.
+	if(((rxData[0] & RDA5807_SEEK_TUNE_COMPLETE) == 0) || ((rxData[0] & RDA5807_CHANNEL_INFO) != _scanChannel))
+	{
+		if((++_scanWait) < getStcTimeout())
+		{
+			return TRUE;
+		}
+		
+		// Missed tune is issued again, the channel is skipped only if it fails once more.
+		if(_scanRetry < SCAN_STEP_RETRIES)
+		{
+			_scanRetry++;
+			scanResult.retries++;
+			updateChannel(_scanChannel);
+			_scanWait = 0;
+			return TRUE;
+		}
+		
+		scanResult.timeouts++;
+		rxData[1] = 0;
+	}
+	else
+	{
+		// Measured STC time sizes the timeout of the following channels.
+		addStcTime(_scanWait);
+	}
+	
+	channel = _scanChannel;
+	rssi = rxData[1] >> RDA5807_RSSI_SHIFT;
+	stationFound = ((rxData[1] & RDA5807_FM_TRUE) && (rssi >= SCAN_MIN_RSSI)) ? TRUE : FALSE;
+	
+	// Tune the next channel, tune and RSSI read of a channel do not overlap.
+	if(_scanChannel < SCAN_LAST_CHANNEL)
+	{
+		updateChannel(++_scanChannel);
+		_scanWait = 0;
+		_scanRetry = 0;
+	}
+	else
+	{
+		setReceiverMute(FALSE);
+		updateChannel(_scanRestoreChannel);
+		scanResult.elapsedTicks = getSystemTicks() - _scanStartTick;
+		scanResult.stcAverage = _scanStcAverage >> 3;
+		_scanRunning = FALSE;
+	}
+	
+	if(stationFound == TRUE)
+	{
+		addStation(channel, rssi);
+	}
+	
+	return _scanRunning;
+}
+
+BOOL isBandScanRunning()
+{
+	return _scanRunning;
+}
+
+unsigned short getScanTime()
+{
+	return scanResult.elapsedTicks * SCHED_TICK_MS;
+}
+
+unsigned char autoStoreStations(unsigned char count)
+{
+	unsigned char channels[SCAN_TABLE_SIZE];
+	unsigned char pos, sortPos, temp;
+	
+	if(count > scanResult.count)
+	{
+		count = scanResult.count;
+	}
+	
+	// Strongest stations are stored into the presets in frequency order.
+	for(pos = 0; pos < count; pos++)
+	{
+		channels[pos] = scanResult.stations[pos].channel;
+		
+		for(sortPos = pos; (sortPos > 0) && (channels[sortPos - 1] > channels[sortPos]); sortPos--)
+		{
+			temp = channels[sortPos];
+			channels[sortPos] = channels[sortPos - 1];
+			channels[sortPos - 1] = temp;
+		}
+	}
+	
+	for(pos = 0; pos < count; pos++)
+	{
+		saveMemoryStation(pos, channels[pos]);
+	}
+	
+	return count;
+}
+
+static void issueSeek()
+{
+	seekStats.hardwareSeeks++;
+	_seekSettle = 0;
+	_seekState = SEEK_RUNNING;
+	startSeek(_seekMode);
+}
+
+static void finishSeek(BOOL found)
+{
+	if(found == TRUE)
+	{
+		seekStats.found++;
+	}
+	else
+	{
+		// Nothing usable in the band, go back to the channel where the seek started.
+		updateChannel(_seekStartChannel);
+	}
+	
+	_seekState = SEEK_IDLE;
+}
+
+void startSeekControl(SEEK_MODE seekMode, unsigned short startChannel, BOOL wrap)
+{
+	seekStats.requests++;
+	
+	_seekMode = seekMode;
+	_seekStartChannel = startChannel;
+	_seekWrap = wrap;
+	_seekWrapped = FALSE;
+	
+	// Band edges are handled here, the receiver always stops at the band limit.
+	setReceiverSeekWrap(FALSE);
+	issueSeek();
+}
+
+BOOL serviceSeek(unsigned short *rxData)
+{
+	unsigned short channel;
+	BOOL passedStart;
+	
+	if((_seekState == SEEK_IDLE) || (!(rxData[0] & RDA5807_SEEK_TUNE_COMPLETE)))
+	{
+		return (_seekState != SEEK_IDLE) ? TRUE : FALSE;
+	}
+	
+	// Seek (or the wrap tune) is over, register 0x02 may be written again without SEEK.
+	endReceiverSeek();
+	channel = rxData[0] & RDA5807_CHANNEL_INFO;
+	
+	// Receiver is tuned to the opposite band edge, continue the seek from there.
+	if(_seekState == SEEK_WRAPPING)
+	{
+		issueSeek();
+		return TRUE;
+	}
+	
+	if(rxData[0] & RDA5807_SEEK_FAIL)
+	{
+		// Band limit is reached without any station.
+		if((_seekWrap == TRUE) && (_seekWrapped == FALSE))
+		{
+			seekStats.wraps++;
+			_seekWrapped = TRUE;
+			_seekState = SEEK_WRAPPING;
+			updateChannel((_seekMode == SKMODE_UP) ? SCAN_FIRST_CHANNEL : SCAN_LAST_CHANNEL);
+			return TRUE;
+		}
+		
+		finishSeek(FALSE);
+		return FALSE;
+	}
+	
+	// Give RSSI some time to settle before the stop is qualified.
+	if((!(rxData[1] & RDA5807_FM_READY)) && ((++_seekSettle) < SEEK_SETTLE_POLLS))
+	{
+		return TRUE;
+	}
+	
+	if((rxData[1] & RDA5807_FM_TRUE) && ((rxData[1] >> RDA5807_RSSI_SHIFT) >= SEEK_MIN_RSSI))
+	{
+		finishSeek(TRUE);
+		return FALSE;
+	}
+	
+	// False stop: continue unless the whole band is already covered.
+	seekStats.falseStops++;
+	passedStart = (_seekMode == SKMODE_UP) ? (channel >= _seekStartChannel) : (channel <= _seekStartChannel);
+	if((_seekWrapped == TRUE) && (passedStart == TRUE))
+	{
+		finishSeek(FALSE);
+		return FALSE;
+	}
+	
+	issueSeek();
+	return TRUE;
+}
+
+BOOL isSeekRunning()
+{
+	return (_seekState != SEEK_IDLE) ? TRUE : FALSE;
+}
+
+void abortSeek()
+{
+	if(_seekState == SEEK_IDLE)
+	{
+		return;
+	}
+	
+	seekStats.aborts++;
+	stopReceiverSeek();
+	finishSeek(FALSE);
+}
@@ -0,0 +1,99 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include "global.h"
+#include "rda5807m.h"
+
+// Band scan covers the same channel range as the manual tuner control.
+#define SCAN_FIRST_CHANNEL	0
+#define SCAN_LAST_CHANNEL	210
+
+#define SCAN_TABLE_SIZE		16
+
+// Minimum RSSI (0 - 127, log scale) of a channel to be listed as a station.
+#define SCAN_MIN_RSSI		20
+
+// STC wait of a tune in system ticks (1ms): twice the average STC time measured by the scan and the AF probes,
+// within these bounds. The estimate starts at the upper bound.
+#define SCAN_STEP_TIMEOUT_MIN	10
+#define SCAN_STEP_TIMEOUT_MAX	60
+
+// Channel without STC is tuned again this many times before it is skipped.
+#define SCAN_STEP_RETRIES	1
+
+// Channels are tuned one after the other, a pass takes about 211 x the average STC time.
+// Worst case, every channel times out at the upper bound and fails the retry: 211 x 60ms x 2 = ~25.3s.
+
+// Minimum RSSI of a seek stop, weaker stops are skipped and the seek continues.
+#define SEEK_MIN_RSSI		24
+
+// Number of status polls to wait for FM_READY after a seek stop.
+#define SEEK_SETTLE_POLLS	5
+
+typedef struct
+{
+	unsigned char channel;
+	unsigned char rssi;
+} SCAN_STATION;
+
+typedef struct
+{
+	SCAN_STATION stations[SCAN_TABLE_SIZE];		// Sorted by RSSI, strongest first.
+	unsigned char count;
+	unsigned char timeouts;				// Channels skipped without STC.
+	unsigned char retries;
+	unsigned char stcAverage;			// Average STC time of a channel, in system ticks.
+	unsigned short elapsedTicks;		// System ticks (1ms) of the last scan.
+} SCAN_RESULT;
+
+typedef struct
+{
+	unsigned short requests;		// Seeks requested by the user.
+	unsigned short hardwareSeeks;	// Seek commands issued to the receiver, including continuations.
+	unsigned short found;
+	unsigned short falseStops;
+	unsigned short wraps;
+	unsigned short aborts;
+} SEEK_STATS;
+
+extern SCAN_RESULT scanResult;
+extern SEEK_STATS seekStats;
+
+void startBandScan(unsigned short restoreChannel);
+BOOL serviceBandScan();
+BOOL isBandScanRunning();
+
+unsigned short getScanTime();
+unsigned char autoStoreStations(unsigned char count);
+
+unsigned char getStcTimeout();
+void addStcTime(unsigned char ticks);
+
+void startSeekControl(SEEK_MODE seekMode, unsigned short startChannel, BOOL wrap);
+BOOL serviceSeek(unsigned short *rxData);
+BOOL isSeekRunning();
+void abortSeek();
+
+#endif /* SCAN_H_ */
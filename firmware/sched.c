@@ -0,0 +1,280 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#include "global.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+#include "sched.h"
+#include "encoder.h"
+#include "buttons.h"
+#include "rda5807m.h"
+
+static SCHED_TASK _tasks[SCHED_MAX_TASKS];
+static unsigned char _taskCount;
+
+static volatile unsigned short _sysTicks;
+
+volatile SCHED_STATS schedStats;
+
+// Sleep time (timer1 counts) of the current duty cycle window.
+static unsigned long _sleepCounts;
+static unsigned short _dutyStart;
+
+// Linker symbols: end of the static data and top of the SRAM.
+extern unsigned char _end;
+extern unsigned char __stack;
+
+void paintStack() __attribute__ ((naked, used, section (".init1")));
+
+void paintStack()
+{
+	// Runs before the stack and r1 are set up, so only Z and r24/r25 are used.
+	asm volatile (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		:: "i" (SCHED_STACK_CANARY));
+}
+
+ISR (TIMER1_COMPA_vect)
+{
+	unsigned short isrCounts;
+	
+	_sysTicks++;
+	
+	// Rotary encoder, buttons and the RDS status are sampled from the tick, samples are not lost while tasks are busy.
+	encoderTick();
+	buttonTick();
+	rdsCaptureTick();
+	
+	// Timer restarts at the compare match, the count at the end covers the entry latency and the ISR body.
+	isrCounts = TCNT1;
+	if(isrCounts > schedStats.tickIsrMax)
+	{
+		schedStats.tickIsrMax = isrCounts;
+	}
+}
+
+void initScheduler()
+{
+	_taskCount = 0;
+	_sysTicks = 0;
+	_sleepCounts = 0;
+	_dutyStart = 0;
+	
+	// CTC mode with 8 prescaler, (499 + 1) counts gives 1ms.
+	TCNT1 = 0x00;
+	TCCR1A = 0x00;
+	TCCR1B = (1 << WGM12) | (1 << CS11);
+	OCR1A = SCHED_TICK_COUNTS - 1;
+	TIMSK |= (1 << OCIE1A);
+	
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+unsigned short getSystemTicks()
+{
+	unsigned short ticks;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks = _sysTicks;
+	}
+	
+	return ticks;
+}
+
+static BOOL isDue(unsigned short due, unsigned short now)
+{
+	// Wrap safe compare, valid for periods below 32768 ticks.
+	return ((signed short)(now - due) >= 0) ? TRUE : FALSE;
+}
+
+unsigned char addTimer(SCHED_FUNC func)
+{
+	if(_taskCount >= SCHED_MAX_TASKS)
+	{
+		return SCHED_INVALID_ID;
+	}
+	
+	_tasks[_taskCount].func = func;
+	_tasks[_taskCount].period = 0;
+	_tasks[_taskCount].overruns = 0;
+	_tasks[_taskCount].active = FALSE;
+	
+	return _taskCount++;
+}
+
+unsigned char addTask(SCHED_FUNC func, unsigned short period, unsigned short phase)
+{
+	unsigned char id = addTimer(func);
+	
+	// Phase spreads tasks of the same period over different ticks.
+	if(id != SCHED_INVALID_ID)
+	{
+		startTimer(id, phase, period);
+	}
+	
+	return id;
+}
+
+void startTimer(unsigned char id, unsigned short delay, unsigned short period)
+{
+	// Registration may have failed on a full table.
+	if(id >= _taskCount)
+	{
+		return;
+	}
+	
+	_tasks[id].period = period;
+	_tasks[id].due = getSystemTicks() + delay;
+	_tasks[id].active = TRUE;
+}
+
+BOOL isTimerActive(unsigned char id)
+{
+	return (id < _taskCount) ? _tasks[id].active : FALSE;
+}
+
+unsigned char getTaskOverruns(unsigned char id)
+{
+	return (id < _taskCount) ? _tasks[id].overruns : 0;
+}
+
+static unsigned short getStackFree()
+{
+	const unsigned char *pos = &_end;
+	
+	// Stack grows down towards the static data, the deepest use overwrote the canary above it.
+	while((pos < &__stack) && (*pos == SCHED_STACK_CANARY))
+	{
+		pos++;
+	}
+	
+	return pos - &_end;
+}
+
+static void updateDutyCycle(unsigned short now)
+{
+	unsigned long windowCounts;
+	
+	if((now - _dutyStart) < SCHED_DUTY_TICKS)
+	{
+		return;
+	}
+	
+	windowCounts = (unsigned long)(now - _dutyStart) * SCHED_TICK_COUNTS;
+	schedStats.duty = 1000 - ((_sleepCounts * 1000) / windowCounts);
+	
+	_sleepCounts = 0;
+	_dutyStart = now;
+	
+	schedStats.stackFree = getStackFree();
+}
+
+void runScheduler()
+{
+	SCHED_TASK *task;
+	unsigned char id;
+	unsigned short now = getSystemTicks();
+	unsigned short sleepStart, wakeTicks;
+	BOOL taskRun = FALSE;
+	
+	updateDutyCycle(now);
+	
+	for(id = 0; id < _taskCount; id++)
+	{
+		task = &_tasks[id];
+		
+		if((task->active == FALSE) || (isDue(task->due, now) == FALSE))
+		{
+			continue;
+		}
+		
+		if(task->period == 0)
+		{
+			task->active = FALSE;
+		}
+		else if(isDue((task->due + task->period), now) == TRUE)
+		{
+			// Missed one or more runs, restart the period from now instead of bursting.
+			if(task->overruns < 0xFF)
+			{
+				task->overruns++;
+			}
+			
+			schedStats.overruns++;
+			
+			task->due = now + task->period;
+		}
+		else
+		{
+			task->due += task->period;
+		}
+		
+		// Tasks run to completion, a task may start or stop timers (including itself).
+		task->func();
+		taskRun = TRUE;
+	}
+	
+	if(taskRun == TRUE)
+	{
+		return;
+	}
+	
+	// Nothing was due in this tick, idle until the next interrupt (tick, TWI, LCD or EEPROM).
+	cli();
+	if(_sysTicks == now)
+	{
+		sleepStart = TCNT1;
+		
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		
+		// Tick interrupt ends the sleep at the compare match, other interrupts at the current count.
+		cli();
+		wakeTicks = _sysTicks;
+		if(wakeTicks != now)
+		{
+			_sleepCounts += ((unsigned long)(wakeTicks - now) * SCHED_TICK_COUNTS) - sleepStart;
+		}
+		else
+		{
+			_sleepCounts += TCNT1 - sleepStart;
+		}
+	}
+	
+	sei();
+}
@@ -0,0 +1,75 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include "global.h"
+
+// System tick generated by timer1, 500 counts of 2us.
+#define SCHED_TICK_MS		1
+#define SCHED_TICK_COUNTS	500
+
+// Window (in ticks) of the active duty cycle measurement.
+#define SCHED_DUTY_TICKS	1000
+
+// Fill pattern of the unused stack, painted before main and checked in every duty cycle window.
+#define SCHED_STACK_CANARY	0xC5
+
+// Number of periodic tasks and software timers which can be registered (main uses 9 tasks and 1 timer).
+#define SCHED_MAX_TASKS		10
+
+#define SCHED_INVALID_ID	0xFF
+
+typedef void (*SCHED_FUNC)();
+
+typedef struct
+{
+	SCHED_FUNC func;
+	unsigned short period;			// Ticks between runs, 0 for one-shot timers.
+	unsigned short due;
+	unsigned char overruns;			// Runs started a full period or more behind schedule.
+	BOOL active;
+} SCHED_TASK;
+
+typedef struct
+{
+	unsigned short tickIsrMax;		// Longest tick ISR, in timer1 counts (2us) from the compare match.
+	unsigned short duty;			// Time the CPU was awake in the last window, in 1/1000.
+	unsigned short overruns;		// Total of the per task overrun counters.
+	unsigned short stackFree;		// Bytes between the static data and the deepest stack use so far.
+} SCHED_STATS;
+
+extern volatile SCHED_STATS schedStats;
+
+void initScheduler();
+unsigned short getSystemTicks();
+
+unsigned char addTask(SCHED_FUNC func, unsigned short period, unsigned short phase);
+unsigned char addTimer(SCHED_FUNC func);
+void startTimer(unsigned char id, unsigned short delay, unsigned short period);
+BOOL isTimerActive(unsigned char id);
+unsigned char getTaskOverruns(unsigned char id);
+
+void runScheduler();
+
+#endif /* SCHED_H_ */
@@ -22,26 +22,316 @@
 
 #include "global.h"
 
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <string.h>
 
 #include "m62429.h"
+#include "storage.h"
 
-uint8_t data[] EEMEM = {0x00, 0x00, 0x00};
+#define CRC8_INIT	0xFF
+
+#define NAME_NO_SLOT	0xFF
+
+// RAM index of the station name cache, PI and PS stay in the EEPROM records.
+typedef struct
+{
+	unsigned char channel;
+	unsigned char age;				// Lookups since the last use, only kept in RAM.
+} NAME_SLOT;
+
+// CRC-8 lookup table, polynomial x^8 + x^2 + x + 1 (0x07).
+static const unsigned char _crc8Table[256] PROGMEM = 
+{
+	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+	0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+	0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+	0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+	0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+	0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+	0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+	0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+	0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+	0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+	0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+	0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+	0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+	0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+	0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+	0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3
+};
+
+// RAM copy of the stored values.
+static unsigned char _configVolume;
+static unsigned short _configChannel;
+static unsigned short _presets[STORAGE_PRESET_COUNT];
+static NAME_SLOT _names[STORAGE_NAME_COUNT];
+
+// Name record waiting for the write-back (one at a time) and the slots to be dropped.
+static unsigned char _nameRecord[NAME_RECORD_SIZE];
+static volatile unsigned char _nameSlot = NAME_NO_SLOT;
+static volatile BOOL _nameWriting;
+static volatile unsigned char _nameDropped;
+
+static volatile BOOL _configDirty;
+static volatile BOOL _presetDirty;
+static volatile unsigned char _storageQuiet;
+
+// Next sequence numbers and record positions.
+static unsigned char _configSeq;
+static unsigned char _configSlot;
+static unsigned char _presetSeq;
+static unsigned char _presetCopy;
+static unsigned char _nameSeq;
+
+// Record which is being programmed by the EE_RDY interrupt, one byte per interrupt.
+static unsigned char _writeBuffer[PRESET_RECORD_SIZE];
+static unsigned short _writeAddr;
+static volatile unsigned char _writeLength;
+static unsigned char _writePos;
+
+static unsigned char calcCRC8(unsigned char *data, unsigned char dataLen)
+{
+	unsigned char crc = CRC8_INIT;
+	
+	while(dataLen--)
+	{
+		crc = pgm_read_byte(&_crc8Table[crc ^ *data++]);
+	}
+	
+	return crc;
+}
+
+static BOOL isNewerSeq(unsigned char seq, unsigned char refSeq)
+{
+	// Serial number arithmetic, valid as long as the live records span less than 128 sequence numbers.
+	return ((signed char)(seq - refSeq) > 0) ? TRUE : FALSE;
+}
+
+static void buildConfigRecord()
+{
+	_writeBuffer[0] = _configSeq++;
+	_writeBuffer[1] = _configVolume;
+	_writeBuffer[2] = _configChannel & 0xFF;
+	_writeBuffer[3] = _configChannel >> 8;
+	_writeBuffer[CONFIG_RECORD_SIZE - 1] = calcCRC8(_writeBuffer, (CONFIG_RECORD_SIZE - 1));
+	
+	// Hot record moves to the next slot of the ring on every write.
+	_writeAddr = STORAGE_CONFIG_BASE + (_configSlot * CONFIG_RECORD_SIZE);
+	_configSlot = ((_configSlot + 1) < CONFIG_SLOT_COUNT) ? (_configSlot + 1) : 0;
+	_writeLength = CONFIG_RECORD_SIZE;
+}
+
+static void buildPresetRecord()
+{
+	unsigned char pos;
+	
+	_writeBuffer[0] = _presetSeq++;
+	for(pos = 0; pos < STORAGE_PRESET_COUNT; pos++)
+	{
+		_writeBuffer[(pos * 2) + 1] = _presets[pos] & 0xFF;
+		_writeBuffer[(pos * 2) + 2] = _presets[pos] >> 8;
+	}
+	
+	_writeBuffer[PRESET_RECORD_SIZE - 1] = calcCRC8(_writeBuffer, (PRESET_RECORD_SIZE - 1));
+	
+	// A/B commit: the copy holding the current presets is never overwritten.
+	_writeAddr = (_presetCopy == 0) ? STORAGE_PRESET_A : STORAGE_PRESET_B;
+	_presetCopy ^= 0x01;
+	_writeLength = PRESET_RECORD_SIZE;
+}
+
+static void buildNameRecord()
+{
+	_nameRecord[0] = _nameSeq++;
+	_nameRecord[NAME_RECORD_SIZE - 1] = calcCRC8(_nameRecord, (NAME_RECORD_SIZE - 1));
+	memcpy(_writeBuffer, _nameRecord, NAME_RECORD_SIZE);
+	
+	// Every cache entry owns a fixed slot, names change far less often than the tuned channel.
+	_writeAddr = STORAGE_NAME_BASE + (_nameSlot * NAME_RECORD_SIZE);
+	_writeLength = NAME_RECORD_SIZE;
+	_nameWriting = TRUE;
+}
+
+static void buildDropRecord()
+{
+	unsigned char slot = 0;
+	
+	while(!(_nameDropped & (1 << slot)))
+	{
+		slot++;
+	}
+	
+	_nameDropped &= ~(1 << slot);
+	
+	// Invalid channel is enough to drop the record, the rest of the slot is not rewritten.
+	_writeBuffer[0] = _nameSeq++;
+	_writeBuffer[1] = STORAGE_NO_CHANNEL;
+	_writeAddr = STORAGE_NAME_BASE + (slot * NAME_RECORD_SIZE);
+	_writeLength = 2;
+}
+
+static void startNextRecord()
+{
+	if(_writeLength != 0)
+	{
+		return;
+	}
+	
+	if(_presetDirty == TRUE)
+	{
+		_presetDirty = FALSE;
+		buildPresetRecord();
+	}
+	else if((_nameSlot != NAME_NO_SLOT) && (_nameWriting == FALSE))
+	{
+		buildNameRecord();
+	}
+	else if(_nameDropped != 0)
+	{
+		buildDropRecord();
+	}
+	else if((_configDirty == TRUE) && (_storageQuiet == 0))
+	{
+		_configDirty = FALSE;
+		buildConfigRecord();
+	}
+	else
+	{
+		return;
+	}
+	
+	_writePos = 0;
+	EECR |= (1 << EERIE);
+}
+
+ISR (EE_RDY_vect)
+{
+	unsigned short addr;
+	
+	// Program next changed byte of the record, CRC is the last byte so a torn record never validates.
+	while(_writePos < _writeLength)
+	{
+		addr = _writeAddr + _writePos;
+		
+		EEAR = addr;
+		EECR |= (1 << EERE);
+		
+		if(EEDR != _writeBuffer[_writePos])
+		{
+			EEDR = _writeBuffer[_writePos++];
+			EECR |= (1 << EEMWE);
+			EECR |= (1 << EEWE);
+			return;
+		}
+		
+		_writePos++;
+	}
+	
+	_writeLength = 0;
+	EECR &= ~(1 << EERIE);
+	
+	// Name record is in the EEPROM, its slot is read from there from now on.
+	if(_nameWriting == TRUE)
+	{
+		_nameWriting = FALSE;
+		_nameSlot = NAME_NO_SLOT;
+	}
+	
+	startNextRecord();
+}
+
+static void markConfigDirty()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		_configDirty = TRUE;
+		
+		// Every change restarts the quiet period.
+		_storageQuiet = STORAGE_QUIET_TICKS;
+	}
+}
+
+void storageTick()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if((_storageQuiet > 0) && ((--_storageQuiet) == 0))
+		{
+			startNextRecord();
+		}
+	}
+}
+
+void flushStorage()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		_storageQuiet = 0;
+		startNextRecord();
+	}
+}
+
+BOOL isStorageIdle()
+{
+	return ((_configDirty == FALSE) && (_presetDirty == FALSE) && (_nameSlot == NAME_NO_SLOT) && (_nameDropped == 0) && (_writeLength == 0) && (!(EECR & (1 << EEWE)))) ? TRUE : FALSE;
+}
 
 void saveVolume(SYS_CONFIG *config)
 {
-	eeprom_update_byte(0x00, config->volume);
+	if(config->volume != _configVolume)
+	{
+		_configVolume = config->volume;
+		markConfigDirty();
+	}
 }
 
 void saveReceiverChannel(SYS_CONFIG *config)
 {
-	eeprom_update_word((uint16_t*)0x01, config->currentChannel);
+	if(config->currentChannel != _configChannel)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			_configChannel = config->currentChannel;
+		}
+		
+		markConfigDirty();
+	}
 }
 
 void loadConfig(SYS_CONFIG *config)
 {
-	config->volume = eeprom_read_byte(0x00);
-	config->currentChannel = eeprom_read_word((uint16_t*)0x01);
+	unsigned char record[PRESET_RECORD_SIZE];
+	unsigned char slot, pos;
+	BOOL found = FALSE;
+	
+	config->volume = DEFAULT_VOLUME;
+	config->currentChannel = DEFAULT_CHANNEL;
+	_configSeq = 0;
+	_configSlot = 0;
+	
+	// Single scan over the config ring, newest valid record wins.
+	for(slot = 0; slot < CONFIG_SLOT_COUNT; slot++)
+	{
+		eeprom_read_block(record, (const void*)(STORAGE_CONFIG_BASE + (slot * CONFIG_RECORD_SIZE)), CONFIG_RECORD_SIZE);
+		
+		if(calcCRC8(record, (CONFIG_RECORD_SIZE - 1)) != record[CONFIG_RECORD_SIZE - 1])
+		{
+			continue;
+		}
+		
+		if((found == FALSE) || (isNewerSeq(record[0], (_configSeq - 1)) == TRUE))
+		{
+			found = TRUE;
+			config->volume = record[1];
+			config->currentChannel = (record[3] << 8) | record[2];
+			_configSeq = record[0] + 1;
+			_configSlot = ((slot + 1) < CONFIG_SLOT_COUNT) ? (slot + 1) : 0;
+		}
+	}
 	
 	// Check overflows in received values.
 	if(config->volume > MAX_VOLUME)
@@ -49,27 +339,253 @@ void loadConfig(SYS_CONFIG *config)
 		config->volume = DEFAULT_VOLUME;
 	}
 	
-	if(config->currentChannel == 0xFFFF)
+	if(config->currentChannel > STORAGE_MAX_CHANNEL)
 	{
 		config->currentChannel = DEFAULT_CHANNEL;
 	}
+	
+	_configVolume = config->volume;
+	_configChannel = config->currentChannel;
+	
+	// Preset block: pick the newest valid copy of A and B, the next commit goes to the other one.
+	found = FALSE;
+	_presetSeq = 0;
+	_presetCopy = 0;
+	
+	for(pos = 0; pos < STORAGE_PRESET_COUNT; pos++)
+	{
+		_presets[pos] = DEFAULT_CHANNEL;
+	}
+	
+	for(slot = 0; slot < 2; slot++)
+	{
+		eeprom_read_block(record, (const void*)((slot == 0) ? STORAGE_PRESET_A : STORAGE_PRESET_B), PRESET_RECORD_SIZE);
+		
+		if(calcCRC8(record, (PRESET_RECORD_SIZE - 1)) != record[PRESET_RECORD_SIZE - 1])
+		{
+			continue;
+		}
+		
+		if((found == FALSE) || (isNewerSeq(record[0], (_presetSeq - 1)) == TRUE))
+		{
+			found = TRUE;
+			for(pos = 0; pos < STORAGE_PRESET_COUNT; pos++)
+			{
+				_presets[pos] = (record[(pos * 2) + 2] << 8) | record[(pos * 2) + 1];
+			}
+			
+			_presetSeq = record[0] + 1;
+			_presetCopy = slot ^ 0x01;
+		}
+	}
+	
+	// Station name cache, the write order of the records gives the initial LRU order.
+	found = FALSE;
+	_nameSeq = 0;
+	_nameSlot = NAME_NO_SLOT;
+	_nameWriting = FALSE;
+	_nameDropped = 0;
+	
+	for(slot = 0; slot < STORAGE_NAME_COUNT; slot++)
+	{
+		eeprom_read_block(record, (const void*)(STORAGE_NAME_BASE + (slot * NAME_RECORD_SIZE)), NAME_RECORD_SIZE);
+		
+		_names[slot].channel = STORAGE_NO_CHANNEL;
+		_names[slot].age = record[0];
+		
+		if((calcCRC8(record, (NAME_RECORD_SIZE - 1)) != record[NAME_RECORD_SIZE - 1]) || (record[1] > STORAGE_MAX_CHANNEL))
+		{
+			continue;
+		}
+		
+		_names[slot].channel = record[1];
+		
+		if((found == FALSE) || (isNewerSeq(record[0], (_nameSeq - 1)) == TRUE))
+		{
+			found = TRUE;
+			_nameSeq = record[0] + 1;
+		}
+	}
+	
+	for(slot = 0; slot < STORAGE_NAME_COUNT; slot++)
+	{
+		_names[slot].age = (_nameSeq - 1) - _names[slot].age;
+	}
 }
 
 unsigned short loadMemorySlot(unsigned char memChannel)
 {
-	unsigned short memoryData = eeprom_read_word((uint16_t*)((memChannel * 2) + 0x03));
-	return (memoryData == 0xFFFF) ? DEFAULT_CHANNEL : memoryData;
+	return (_presets[memChannel] > STORAGE_MAX_CHANNEL) ? DEFAULT_CHANNEL : _presets[memChannel];
 }
 
 BOOL saveMemoryStation(unsigned char memChannel, unsigned short channel)
 {
-	unsigned short memAddr = (memChannel * 2) + 0x03;
-	if(eeprom_read_word((uint16_t*)memAddr) != channel)
+	if(_presets[memChannel] != channel)
 	{
-		// Save new channel into specified memory location.
-		eeprom_update_word((uint16_t*)memAddr, channel);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			_presets[memChannel] = channel;
+			_presetDirty = TRUE;
+		}
+		
+		// Presets are explicit user actions, write them back without the quiet period.
+		flushStorage();
 		return TRUE;
 	}
 	
 	return FALSE;
+}
+
+static signed char findNameSlot(unsigned char channel)
+{
+	signed char slot;
+	
+	for(slot = 0; slot < STORAGE_NAME_COUNT; slot++)
+	{
+		if(_names[slot].channel == channel)
+		{
+			return slot;
+		}
+	}
+	
+	return -1;
+}
+
+static void touchNameSlot(unsigned char usedSlot)
+{
+	unsigned char slot;
+	
+	for(slot = 0; slot < STORAGE_NAME_COUNT; slot++)
+	{
+		if(_names[slot].age < 0xFF)
+		{
+			_names[slot].age++;
+		}
+	}
+	
+	_names[usedSlot].age = 0;
+}
+
+static void readNameRecord(unsigned char slot, unsigned char *record)
+{
+	BOOL resume = FALSE;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Record waiting for (or in) the write-back is read from RAM.
+		if(_nameSlot == slot)
+		{
+			memcpy(record, _nameRecord, NAME_RECORD_SIZE);
+			return;
+		}
+		
+		// EEPROM can not be read during a write, the write-back is paused so the wait is one byte write at most.
+		if(EECR & (1 << EERIE))
+		{
+			resume = TRUE;
+			EECR &= ~(1 << EERIE);
+		}
+	}
+	
+	eeprom_read_block(record, (const void*)(STORAGE_NAME_BASE + (slot * NAME_RECORD_SIZE)), NAME_RECORD_SIZE);
+	
+	if(resume == TRUE)
+	{
+		EECR |= (1 << EERIE);
+	}
+}
+
+BOOL findStationName(unsigned char channel, unsigned short *pi, char *ps)
+{
+	unsigned char record[NAME_RECORD_SIZE];
+	signed char slot = findNameSlot(channel);
+	
+	if(slot < 0)
+	{
+		return FALSE;
+	}
+	
+	// Lookups only update the LRU order in RAM, EEPROM is written when the name itself changes.
+	touchNameSlot(slot);
+	readNameRecord(slot, record);
+	*pi = (record[3] << 8) | record[2];
+	memcpy(ps, &record[4], RDS_PS_LENGTH);
+	
+	return TRUE;
+}
+
+void saveStationName(unsigned char channel, unsigned short pi, char *ps)
+{
+	unsigned char record[NAME_RECORD_SIZE];
+	signed char slot = findNameSlot(channel);
+	unsigned char pos;
+	
+	if(slot >= 0)
+	{
+		touchNameSlot(slot);
+		readNameRecord(slot, record);
+		if((((record[3] << 8) | record[2]) == pi) && (memcmp(&record[4], ps, RDS_PS_LENGTH) == 0))
+		{
+			return;
+		}
+	}
+	else
+	{
+		// Reuse a free slot or evict the least recently used name.
+		slot = 0;
+		for(pos = 0; pos < STORAGE_NAME_COUNT; pos++)
+		{
+			if(_names[pos].channel == STORAGE_NO_CHANNEL)
+			{
+				slot = pos;
+				break;
+			}
+			
+			if(_names[pos].age > _names[slot].age)
+			{
+				slot = pos;
+			}
+		}
+		
+		touchNameSlot(slot);
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// One name record is staged at a time, a name learned meanwhile is learned again on a later tune.
+		if((_nameSlot == NAME_NO_SLOT) || ((_nameSlot == slot) && (_nameWriting == FALSE)))
+		{
+			_names[slot].channel = channel;
+			_nameRecord[1] = channel;
+			_nameRecord[2] = pi & 0xFF;
+			_nameRecord[3] = pi >> 8;
+			memcpy(&_nameRecord[4], ps, RDS_PS_LENGTH);
+			
+			_nameSlot = slot;
+			_nameDropped &= ~(1 << slot);
+			startNextRecord();
+		}
+	}
+}
+
+void dropStationName(unsigned char channel)
+{
+	signed char slot = findNameSlot(channel);
+	
+	if(slot >= 0)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			_names[slot].channel = STORAGE_NO_CHANNEL;
+			
+			// Staged name of the slot is not written any more.
+			if((_nameSlot == slot) && (_nameWriting == FALSE))
+			{
+				_nameSlot = NAME_NO_SLOT;
+			}
+			
+			_nameDropped |= (1 << slot);
+			startNextRecord();
+		}
+	}
 }
\ No newline at end of file
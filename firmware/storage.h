@@ -23,6 +23,32 @@
 #ifndef STORAGE_H_
 #define STORAGE_H_
 
+#include "global.h"
+#include "rds.h"
+
+// Journal layout of the 512 byte EEPROM.
+// Config ring: 72 slots of {seq, volume, channel (LE), crc8}, written round-robin.
+// Preset block: two copies (A/B) of {seq, 6 channels (LE), crc8}.
+// Station name cache: 8 slots of {seq, channel, PI (LE), PS, crc8}, RAM keeps only the channel index and PI/PS are read on demand.
+// Wear and power-cut behaviour of the journal is checked on the host by test/storage_sim (make -C test check).
+#define CONFIG_RECORD_SIZE		5
+#define CONFIG_SLOT_COUNT		72
+#define PRESET_RECORD_SIZE		14
+#define NAME_RECORD_SIZE		(RDS_PS_LENGTH + 5)
+
+#define STORAGE_CONFIG_BASE		0x000
+#define STORAGE_PRESET_A		(STORAGE_CONFIG_BASE + (CONFIG_SLOT_COUNT * CONFIG_RECORD_SIZE))
+#define STORAGE_PRESET_B		(STORAGE_PRESET_A + PRESET_RECORD_SIZE)
+#define STORAGE_NAME_BASE		(STORAGE_PRESET_B + PRESET_RECORD_SIZE)
+
+#define STORAGE_PRESET_COUNT	6
+#define STORAGE_NAME_COUNT		8
+#define STORAGE_MAX_CHANNEL		210
+#define STORAGE_NO_CHANNEL		0xFF
+
+// Changed values are written back after STORAGE_QUIET_TICKS storageTick calls (100ms) without a change.
+#define STORAGE_QUIET_TICKS		30
+
 void saveVolume(SYS_CONFIG *config);
 void saveReceiverChannel(SYS_CONFIG *config);
 
@@ -31,4 +57,12 @@ void loadConfig(SYS_CONFIG *config);
 unsigned short loadMemorySlot(unsigned char memChannel);
 BOOL saveMemoryStation(unsigned char memChannel, unsigned short channel);
 
+BOOL findStationName(unsigned char channel, unsigned short *pi, char *ps);
+void saveStationName(unsigned char channel, unsigned short pi, char *ps);
+void dropStationName(unsigned char channel);
+
+void storageTick();
+void flushStorage();
+BOOL isStorageIdle();
+
 #endif /* STORAGE_H_ */
\ No newline at end of file
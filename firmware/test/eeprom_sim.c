@@ -0,0 +1,103 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+#include "global.h"
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "eeprom_sim.h"
+
+unsigned long simWriteLimit;
+
+unsigned char simEEPROM[SIM_EEPROM_SIZE];
+unsigned long simCellWrites[SIM_EEPROM_SIZE];
+unsigned long simTotalWrites;
+
+static volatile unsigned char _eecr;
+static volatile unsigned char _eedr;
+static volatile unsigned short _eear;
+
+void EE_RDY_vect();
+
+volatile unsigned char *simEECR()
+{
+	return &_eecr;
+}
+
+volatile unsigned char *simEEDR()
+{
+	// EERE strobe loads the addressed byte into the data register.
+	if(_eecr & (1 << EERE))
+	{
+		_eedr = simEEPROM[_eear % SIM_EEPROM_SIZE];
+		_eecr &= ~(1 << EERE);
+	}
+	
+	return &_eedr;
+}
+
+volatile unsigned short *simEEAR()
+{
+	return &_eear;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t len)
+{
+	memcpy(dst, &simEEPROM[(size_t)src], len);
+}
+
+void simEraseEEPROM()
+{
+	memset(simEEPROM, 0xFF, sizeof(simEEPROM));
+	memset(simCellWrites, 0, sizeof(simCellWrites));
+	simTotalWrites = 0;
+	simWriteLimit = 0;
+	_eecr = 0;
+}
+
+BOOL simRunEEPROM()
+{
+	// EE_RDY fires as long as it is enabled and no write is in progress, each write completes at once.
+	while(_eecr & (1 << EERIE))
+	{
+		EE_RDY_vect();
+		
+		if(_eecr & (1 << EEWE))
+		{
+			// Power cut during the byte write: erase is done, the new value is not programmed.
+			if((simWriteLimit != 0) && (simTotalWrites >= simWriteLimit))
+			{
+				simEEPROM[_eear % SIM_EEPROM_SIZE] = 0xFF;
+				return FALSE;
+			}
+			
+			simEEPROM[_eear % SIM_EEPROM_SIZE] = _eedr;
+			simCellWrites[_eear % SIM_EEPROM_SIZE]++;
+			simTotalWrites++;
+			_eecr &= ~((1 << EEWE) | (1 << EEMWE));
+		}
+	}
+	
+	return TRUE;
+}
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# Generates the synthetic RDS group streams used by rds_test, the output is deterministic (fixed seed).
+#
+# Each tune starts at a random point of a station's group sequence: 40% 0A (PS / AF), 50% 2A (RT) and
+# 10% 4A (CT). Error levels follow the receiver's BLERA / BLERB report, a corrected block B or a failed
+# block A come with a chance of bit errors in block D since the receiver has no flags for blocks C and D.
+#
+#   python3 gen_groups.py clean > rds_clean.txt
+#   python3 gen_groups.py mixed > rds_mixed.txt
+#   python3 gen_groups.py noisy > rds_noisy.txt
+
+import random
+import sys
+
+TUNES = 100
+GROUPS_PER_TUNE = 60
+
+STATIONS = ["RADIO 1 ", "CLASSIC ", "JAZZ FM ", "NEWS 24 ", "KISS FM ", "ROCK 105", "BBC R4  ", "SKY RDIO",
+	"CAPITAL ", "HITS 96 ", "GOLD    ", "SMOOTH  ", "HEART FM", "LBC     ", "MAGIC   ", "KERRANG "]
+RADIO_TEXT = "NOW PLAYING ON THE BEST MIX OF THE 80S 90S AND TODAY\r"
+
+# (probability, error level of block B, chance of a wrong bit in block D) per group.
+PROFILES = {
+	"clean": [(1.00, 0, 0.00)],
+	"mixed": [(0.65, 0, 0.00), (0.20, 1, 0.10), (0.10, 2, 0.40), (0.05, 3, 0.60)],
+	"noisy": [(0.30, 0, 0.00), (0.30, 1, 0.15), (0.25, 2, 0.50), (0.15, 3, 0.60)],
+}
+
+def pick_errors(rng, profile):
+	roll = rng.random()
+	for probability, level, flip in profile:
+		if roll < probability:
+			return level, flip
+		roll -= probability
+	return profile[-1][1], profile[-1][2]
+
+def station_groups(pi, ps):
+	groups = []
+	psSegment = 0
+	rtSegment = 0
+	pattern = ["0A", "2A", "0A", "2A", "2A", "0A", "2A", "0A", "2A", "4A"]
+	for kind in pattern * 8:
+		if kind == "0A":
+			blockB = 0x0000 | (10 << 5) | 0x0400 | psSegment
+			blockC = 0xE000 | 0x0041
+			blockD = (ord(ps[psSegment * 2]) << 8) | ord(ps[psSegment * 2 + 1])
+			psSegment = (psSegment + 1) & 0x03
+		elif kind == "2A":
+			text = RADIO_TEXT.ljust(64)
+			blockB = 0x2000 | (10 << 5) | 0x0400 | rtSegment
+			blockC = (ord(text[rtSegment * 4]) << 8) | ord(text[rtSegment * 4 + 1])
+			blockD = (ord(text[rtSegment * 4 + 2]) << 8) | ord(text[rtSegment * 4 + 3])
+			rtSegment = (rtSegment + 1) % 14
+		else:
+			blockB = 0x4000 | (10 << 5) | 0x0400 | 0x0001
+			blockC = 0xC5A0
+			blockD = 0x7A02
+		groups.append((pi, blockB, blockC, blockD))
+	return groups
+
+def main():
+	if (len(sys.argv) != 2) or (sys.argv[1] not in PROFILES):
+		sys.exit("usage: gen_groups.py clean|mixed|noisy")
+
+	name = sys.argv[1]
+	profile = PROFILES[name]
+	rng = random.Random(0x5D5 + len(name))
+
+	print("# Synthetic RDS group streams (%s), generated by gen_groups.py, do not edit." % name)
+	print("# TUNE \"<expected PS>\" starts a tune, then one group per line: block A B C D and the")
+	print("# error byte (BLERA << 2 | BLERB) as hex.")
+
+	for tune in range(TUNES):
+		station = rng.randrange(len(STATIONS))
+		ps = STATIONS[station]
+		sequence = station_groups(0xC201 + station, ps)
+		start = rng.randrange(len(sequence))
+
+		print("TUNE \"%s\"" % ps)
+		for index in range(GROUPS_PER_TUNE):
+			blocks = list(sequence[(start + index) % len(sequence)])
+			blerB, flip = pick_errors(rng, profile)
+			blerA = blerB if (blerB == 0) or (rng.random() < 0.5) else min(3, blerB + rng.randrange(2))
+
+			if rng.random() < flip:
+				blocks[3] ^= 1 << rng.randrange(16)
+			if blerA == 3:
+				blocks[0] ^= 1 << rng.randrange(16)
+			if blerB == 3:
+				blocks[1] ^= 1 << rng.randrange(16)
+
+			print("%04X %04X %04X %04X %X" % (blocks[0], blocks[1], blocks[2], blocks[3], (blerA << 2) | blerB))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,248 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+// Host-side test of the RDS decoder (rds.c) on recorded group streams from fixtures/.
+// Groups to a valid PS and wrongly accepted PS names are compared against the previous two-sighting decoder.
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rds.h"
+
+#define TEST_MAX_TUNES		256
+#define TEST_NOT_ACQUIRED	0xFFFF
+
+typedef struct
+{
+	char ps[RDS_PS_LENGTH + 1];
+	char psCandidate[RDS_PS_LENGTH];
+	unsigned char psSegments;
+	unsigned short groupCount;
+	unsigned short psValidGroup;
+} LEGACY_PS;
+
+typedef struct
+{
+	unsigned short groups[TEST_MAX_TUNES];
+	unsigned short tunes;
+	unsigned short wrong;
+} PS_RESULT;
+
+static unsigned long _failures;
+
+static void check(BOOL condition, const char *what)
+{
+	if(condition == FALSE)
+	{
+		printf("FAIL: %s\n", what);
+		_failures++;
+	}
+}
+
+static void legacyDecodeGroup(LEGACY_PS *legacy, RDS_GROUP *group)
+{
+	unsigned char offset = (group->blocks[1] & 0x03) << 1;
+	unsigned char charPos;
+	char charData;
+	BOOL segmentReady = TRUE;
+	
+	legacy->groupCount++;
+	
+	// Previous decoder: 0A / 0B groups with a usable block B, a character is taken after two identical sightings.
+	if(((group->errors & 0x03) == RDS_BLER_FAIL) || ((group->blocks[1] >> 12) != 0))
+	{
+		return;
+	}
+	
+	for(charPos = 0; charPos < 2; charPos++)
+	{
+		charData = (char)((charPos == 0) ? (group->blocks[3] >> 8) : (group->blocks[3] & 0xFF));
+		
+		if(legacy->psCandidate[offset + charPos] == charData)
+		{
+			legacy->ps[offset + charPos] = charData;
+		}
+		else
+		{
+			if((charData >= 0x20) && (charData <= 0x7D))
+			{
+				legacy->psCandidate[offset + charPos] = charData;
+			}
+			
+			segmentReady = FALSE;
+		}
+	}
+	
+	if(segmentReady == TRUE)
+	{
+		legacy->psSegments |= (1 << (group->blocks[1] & 0x03));
+	}
+	
+	if((legacy->psSegments == 0x0F) && (legacy->psValidGroup == 0))
+	{
+		legacy->psValidGroup = legacy->groupCount;
+	}
+}
+
+static void recordTune(PS_RESULT *result, unsigned short validGroup, const char *ps, const char *expected)
+{
+	if(result->tunes >= TEST_MAX_TUNES)
+	{
+		return;
+	}
+	
+	result->groups[result->tunes++] = (validGroup == 0) ? TEST_NOT_ACQUIRED : validGroup;
+	
+	if((validGroup != 0) && (memcmp(ps, expected, RDS_PS_LENGTH) != 0))
+	{
+		result->wrong++;
+	}
+}
+
+static int compareGroups(const void *a, const void *b)
+{
+	return (int)(*(const unsigned short *)a) - (int)(*(const unsigned short *)b);
+}
+
+static unsigned short percentile(PS_RESULT *result, unsigned char percent)
+{
+	unsigned short rank = ((result->tunes * percent) + 99) / 100;
+	
+	qsort(result->groups, result->tunes, sizeof(unsigned short), compareGroups);
+	return result->groups[(rank > 0) ? (rank - 1) : 0];
+}
+
+static void printResult(const char *name, PS_RESULT *result, unsigned short *median, unsigned short *p95)
+{
+	unsigned short acquired = 0;
+	unsigned short pos;
+	
+	for(pos = 0; pos < result->tunes; pos++)
+	{
+		if(result->groups[pos] != TEST_NOT_ACQUIRED)
+		{
+			acquired++;
+		}
+	}
+	
+	*median = percentile(result, 50);
+	*p95 = percentile(result, 95);
+	
+	printf("  %-8s: PS on %u / %u tunes, groups to PS median ", name, acquired, result->tunes);
+	printf((*median == TEST_NOT_ACQUIRED) ? "-" : "%u", *median);
+	printf(" p95 ");
+	printf((*p95 == TEST_NOT_ACQUIRED) ? "-" : "%u", *p95);
+	printf(", wrong PS %u\n", result->wrong);
+}
+
+static BOOL runFixture(const char *fileName, BOOL clean)
+{
+	FILE *fixture;
+	char line[128];
+	char expected[RDS_PS_LENGTH + 1];
+	BOOL inTune = FALSE;
+	unsigned int blocks[4], errors;
+	unsigned short legacyMedian, legacyP95, newMedian, newP95;
+	RDS_DATA rds;
+	RDS_GROUP group;
+	LEGACY_PS legacy;
+	static PS_RESULT legacyResult, newResult;
+	
+	fixture = fopen(fileName, "r");
+	if(fixture == NULL)
+	{
+		printf("FAIL: cannot open %s\n", fileName);
+		_failures++;
+		return FALSE;
+	}
+	
+	memset(&legacyResult, 0, sizeof(PS_RESULT));
+	memset(&newResult, 0, sizeof(PS_RESULT));
+	
+	// One extra pass after the last line closes the final tune.
+	for(;;)
+	{
+		BOOL endOfFile = (fgets(line, sizeof(line), fixture) == NULL) ? TRUE : FALSE;
+		
+		if((endOfFile == TRUE) || (strncmp(line, "TUNE \"", 6) == 0))
+		{
+			if(inTune == TRUE)
+			{
+				recordTune(&newResult, ((rds.valid & RDS_FIELD_PS) ? rds.psValidGroup : 0), rds.ps, expected);
+				recordTune(&legacyResult, legacy.psValidGroup, legacy.ps, expected);
+			}
+			
+			if(endOfFile == TRUE)
+			{
+				break;
+			}
+			
+			memset(expected, 0, sizeof(expected));
+			memcpy(expected, (line + 6), RDS_PS_LENGTH);
+			resetRDSData(&rds);
+			memset(&legacy, 0, sizeof(LEGACY_PS));
+			inTune = TRUE;
+		}
+		else if((inTune == TRUE) && (sscanf(line, "%x %x %x %x %x", &blocks[0], &blocks[1], &blocks[2], &blocks[3], &errors) == 5))
+		{
+			group.blocks[0] = blocks[0];
+			group.blocks[1] = blocks[1];
+			group.blocks[2] = blocks[2];
+			group.blocks[3] = blocks[3];
+			group.errors = errors;
+			
+			decodeRDSGroup(&rds, &group);
+			legacyDecodeGroup(&legacy, &group);
+		}
+	}
+	
+	fclose(fixture);
+	
+	printf("%s\n", fileName);
+	printResult("legacy", &legacyResult, &legacyMedian, &legacyP95);
+	printResult("decoder", &newResult, &newMedian, &newP95);
+	
+	check((newResult.tunes > 0) ? TRUE : FALSE, "fixture holds no tunes");
+	check(((newMedian <= legacyMedian) && (newP95 <= legacyP95)) ? TRUE : FALSE, "decoder needs more groups to PS than the previous decoder");
+	check((newMedian < legacyMedian) ? TRUE : FALSE, "vote counters give no gain over the previous decoder");
+	check((newResult.wrong <= legacyResult.wrong) ? TRUE : FALSE, "decoder accepts more wrong PS names than the previous decoder");
+	
+	if(clean == TRUE)
+	{
+		check((newResult.wrong == 0) ? TRUE : FALSE, "wrong PS accepted on a clean stream");
+	}
+	
+	return TRUE;
+}
+
+int main()
+{
+	runFixture("fixtures/rds_clean.txt", TRUE);
+	runFixture("fixtures/rds_mixed.txt", FALSE);
+	runFixture("fixtures/rds_noisy.txt", FALSE);
+	
+	printf("%s\n", (_failures == 0) ? "PASS" : "FAIL");
+	return (_failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,329 @@
+/*********************************************************************************
+ * Copyright (c) 2019 Dilshan R Jayakody.
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *********************************************************************************/
+
+// Host-side endurance and power-cut simulation of the EEPROM journal (storage.c).
+// storage.c is built unchanged against an emulated EEPROM, the EE_RDY interrupt is run by eeprom_sim.c.
+
+#include "global.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "m62429.h"
+#include "storage.h"
+#include "eeprom_sim.h"
+
+#define SIM_UPDATES			100000UL
+#define SIM_SEED			1
+#define SIM_RELOAD_EVERY	997
+
+// Percentage of the updates which change the volume, the rest change the channel.
+#define SIM_VOLUME_SHARE	70
+
+// Lifetime of the hottest journal cell against the hottest fixed cell, the wear figures of storage.h are checked against it.
+#define SIM_MIN_LIFETIME_GAIN	40
+
+// Previous layout: volume at 0x00, channel (word) at 0x01, written with eeprom_update_*.
+static unsigned char _legacyEEPROM[3];
+static unsigned long _legacyCellWrites[3];
+static unsigned long _legacyTotalWrites;
+
+static unsigned long _failures;
+
+static void legacyUpdateByte(unsigned char addr, unsigned char value)
+{
+	if(_legacyEEPROM[addr] != value)
+	{
+		_legacyEEPROM[addr] = value;
+		_legacyCellWrites[addr]++;
+		_legacyTotalWrites++;
+	}
+}
+
+static BOOL settleStorage()
+{
+	unsigned char tick;
+	
+	// User stops turning the knob, write-back starts after the quiet period.
+	for(tick = 0; tick < STORAGE_QUIET_TICKS; tick++)
+	{
+		storageTick();
+		if(simRunEEPROM() == FALSE)
+		{
+			return FALSE;
+		}
+	}
+	
+	return simRunEEPROM();
+}
+
+static void check(BOOL condition, const char *what)
+{
+	if(condition == FALSE)
+	{
+		printf("FAIL: %s\n", what);
+		_failures++;
+	}
+}
+
+static BOOL isConfig(SYS_CONFIG *config, unsigned char volume, unsigned short channel)
+{
+	return ((config->volume == volume) && (config->currentChannel == channel)) ? TRUE : FALSE;
+}
+
+static void runEndurance()
+{
+	SYS_CONFIG config, loaded;
+	unsigned long update, hottest = 0, legacyHottest = 0;
+	unsigned short pos;
+	
+	simEraseEEPROM();
+	loadConfig(&config);
+	srand(SIM_SEED);
+	
+	for(update = 1; update <= SIM_UPDATES; update++)
+	{
+		if((rand() % 100) < SIM_VOLUME_SHARE)
+		{
+			config.volume = (config.volume + 1 + (rand() % (MAX_VOLUME - 1))) % (MAX_VOLUME + 1);
+			saveVolume(&config);
+			legacyUpdateByte(0, config.volume);
+		}
+		else
+		{
+			config.currentChannel = (config.currentChannel + 1 + (rand() % STORAGE_MAX_CHANNEL)) % (STORAGE_MAX_CHANNEL + 1);
+			saveReceiverChannel(&config);
+			legacyUpdateByte(1, config.currentChannel & 0xFF);
+			legacyUpdateByte(2, config.currentChannel >> 8);
+		}
+		
+		settleStorage();
+		
+		// Reboot now and then, the newest record must be found across ring and sequence wrap-arounds.
+		if((update % SIM_RELOAD_EVERY) == 0)
+		{
+			loadConfig(&loaded);
+			check(isConfig(&loaded, config.volume, config.currentChannel), "reload after update");
+		}
+	}
+	
+	for(pos = 0; pos < SIM_EEPROM_SIZE; pos++)
+	{
+		hottest = (simCellWrites[pos] > hottest) ? simCellWrites[pos] : hottest;
+	}
+	
+	for(pos = 0; pos < 3; pos++)
+	{
+		legacyHottest = (_legacyCellWrites[pos] > legacyHottest) ? _legacyCellWrites[pos] : legacyHottest;
+	}
+	
+	printf("endurance: %lu updates (%d%% volume, %d%% channel)\n", SIM_UPDATES, SIM_VOLUME_SHARE, (100 - SIM_VOLUME_SHARE));
+	printf("  fixed cells : hottest cell %lu writes, %.2f bytes per update\n", legacyHottest, (double)_legacyTotalWrites / SIM_UPDATES);
+	printf("  journal     : hottest cell %lu writes, %.2f bytes per update\n", hottest, (double)simTotalWrites / SIM_UPDATES);
+	printf("  lifetime gain %.1fx, write amplification %.2fx\n", (double)legacyHottest / hottest, (double)simTotalWrites / _legacyTotalWrites);
+	
+	check((legacyHottest >= (hottest * SIM_MIN_LIFETIME_GAIN)) ? TRUE : FALSE, "journal lifetime gain below SIM_MIN_LIFETIME_GAIN");
+}
+
+static void runPowerCut(const char *name, void (*change)(), BOOL (*isOld)(), BOOL (*isNew)())
+{
+	unsigned long cut, start;
+	int status;
+	pid_t child;
+	BOOL complete = FALSE;
+	
+	// Each cut runs in its own process, storage.c keeps the interrupted write-back in its static state.
+	for(cut = 0; complete == FALSE; cut++)
+	{
+		child = fork();
+		if(child == 0)
+		{
+			start = simTotalWrites;
+			simWriteLimit = start + cut + 1;
+			change();
+			complete = settleStorage();
+			
+			if((isOld() == FALSE) && (isNew() == FALSE))
+			{
+				printf("FAIL: %s, power cut after %lu bytes left an invalid record\n", name, cut);
+				fflush(stdout);
+				_exit(1);
+			}
+			
+			_exit(complete == TRUE ? 2 : 0);
+		}
+		
+		waitpid(child, &status, 0);
+		if((!WIFEXITED(status)) || (WEXITSTATUS(status) == 1))
+		{
+			_failures++;
+			return;
+		}
+		
+		complete = (WEXITSTATUS(status) == 2) ? TRUE : FALSE;
+	}
+	
+	printf("power cut: %s, %lu cut positions, every reboot found the old or the new record\n", name, cut);
+}
+
+static void changeConfig()
+{
+	SYS_CONFIG config = {40, 120};
+	
+	saveVolume(&config);
+	saveReceiverChannel(&config);
+}
+
+static BOOL isOldConfig()
+{
+	SYS_CONFIG config;
+	
+	loadConfig(&config);
+	return isConfig(&config, 10, 60);
+}
+
+static BOOL isNewConfig()
+{
+	SYS_CONFIG config;
+	
+	loadConfig(&config);
+	return isConfig(&config, 40, 120);
+}
+
+// Preset 2 is stored again with a new channel, the other presets keep 10 + n.
+#define SIM_PRESET_SLOT		2
+#define SIM_PRESET_CHANNEL	150
+
+static void changePresets()
+{
+	saveMemoryStation(SIM_PRESET_SLOT, SIM_PRESET_CHANNEL);
+}
+
+static BOOL isPresetSet(unsigned short changed)
+{
+	SYS_CONFIG config;
+	unsigned char pos;
+	
+	loadConfig(&config);
+	for(pos = 0; pos < STORAGE_PRESET_COUNT; pos++)
+	{
+		if(loadMemorySlot(pos) != ((pos == SIM_PRESET_SLOT) ? changed : (10 + pos)))
+		{
+			return FALSE;
+		}
+	}
+	
+	return TRUE;
+}
+
+static BOOL isOldPresets()
+{
+	return isPresetSet(10 + SIM_PRESET_SLOT);
+}
+
+static BOOL isNewPresets()
+{
+	return isPresetSet(SIM_PRESET_CHANNEL);
+}
+
+static BOOL isName(unsigned char channel, unsigned short pi, const char *ps)
+{
+	unsigned short foundPI;
+	char foundPS[RDS_PS_LENGTH];
+	
+	if(findStationName(channel, &foundPI, foundPS) == FALSE)
+	{
+		return FALSE;
+	}
+	
+	return ((foundPI == pi) && (memcmp(foundPS, ps, RDS_PS_LENGTH) == 0)) ? TRUE : FALSE;
+}
+
+static void runNameCache()
+{
+	SYS_CONFIG config;
+	unsigned short pi;
+	char ps[RDS_PS_LENGTH];
+	
+	simEraseEEPROM();
+	loadConfig(&config);
+	
+	// Staged record is found before the write-back, from the EEPROM after it and after a reboot.
+	saveStationName(50, 0xC201, "RADIO 1 ");
+	check(isName(50, 0xC201, "RADIO 1 "), "staged station name");
+	
+	// Only one record is staged, a second name is skipped until the write-back is done.
+	saveStationName(60, 0xC202, "RADIO 2 ");
+	check((findStationName(60, &pi, ps) == FALSE) ? TRUE : FALSE, "second staged station name");
+	
+	settleStorage();
+	check(isName(50, 0xC201, "RADIO 1 "), "station name after write-back");
+	saveStationName(60, 0xC202, "RADIO 2 ");
+	settleStorage();
+	
+	loadConfig(&config);
+	check(isName(50, 0xC201, "RADIO 1 "), "station name after reload");
+	check(isName(60, 0xC202, "RADIO 2 "), "second station name after reload");
+	
+	dropStationName(50);
+	settleStorage();
+	loadConfig(&config);
+	check((findStationName(50, &pi, ps) == FALSE) ? TRUE : FALSE, "dropped station name");
+	check(isName(60, 0xC202, "RADIO 2 "), "station name next to the dropped one");
+	
+	printf("name cache: staged, stored, reloaded and dropped names found as expected\n");
+}
+
+int main()
+{
+	SYS_CONFIG config = {10, 60};
+	unsigned char pos;
+	
+	runEndurance();
+	runNameCache();
+	
+	// Known committed state for the power cut runs.
+	simEraseEEPROM();
+	loadConfig(&config);
+	config.volume = 10;
+	config.currentChannel = 60;
+	saveVolume(&config);
+	saveReceiverChannel(&config);
+	for(pos = 0; pos < STORAGE_PRESET_COUNT; pos++)
+	{
+		saveMemoryStation(pos, 10 + pos);
+		simRunEEPROM();
+	}
+	
+	settleStorage();
+	fflush(stdout);
+	
+	runPowerCut("config record", changeConfig, isOldConfig, isNewConfig);
+	fflush(stdout);
+	runPowerCut("preset block", changePresets, isOldPresets, isNewPresets);
+	
+	printf("%s\n", (_failures == 0) ? "PASS" : "FAIL");
+	return (_failures == 0) ? 0 : 1;
+}